@@ -0,0 +1,358 @@
+#define _GNU_SOURCE
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/falloc.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <droplet.h>
+
+#include "block.h"
+#include "hash.h"
+#include "log.h"
+#include "lru.h"
+#include "timeout.h"
+
+extern dpl_ctx_t *ctx;
+
+struct cold_block {
+        time_t atime;
+        size_t index;
+};
+
+struct block_map *
+block_map_new(off_t size)
+{
+        struct block_map *map = NULL;
+
+        map = malloc(sizeof *map);
+        if (! map) {
+                LOG(LOG_ERR, "malloc: %s", strerror(errno));
+                goto err;
+        }
+
+        map->size = size;
+        map->nblocks = (size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+        map->full = 0;
+        map->nopunch = 0;
+        map->present = calloc((map->nblocks + 7) / 8, 1);
+        map->fetching = calloc((map->nblocks + 7) / 8, 1);
+        map->atime = calloc(map->nblocks, sizeof *map->atime);
+        if (! map->present || ! map->fetching || ! map->atime) {
+                LOG(LOG_ERR, "calloc(%zu blocks): %s",
+                    map->nblocks, strerror(errno));
+                free(map->present);
+                free(map->fetching);
+                free(map->atime);
+                free(map);
+                map = NULL;
+                goto err;
+        }
+
+        pthread_rwlock_init(&map->punch_lock, NULL);
+        pthread_mutex_init(&map->mutex, NULL);
+        pthread_cond_init(&map->fetched, NULL);
+
+  err:
+        return map;
+}
+
+void
+block_map_free(struct block_map *map)
+{
+        if (! map)
+                return;
+
+        pthread_rwlock_destroy(&map->punch_lock);
+        pthread_mutex_destroy(&map->mutex);
+        pthread_cond_destroy(&map->fetched);
+        free(map->present);
+        free(map->fetching);
+        free(map->atime);
+        free(map);
+}
+
+static int
+block_present(struct block_map *map,
+              size_t i)
+{
+        return map->present[i / 8] & (1 << (i % 8));
+}
+
+static int
+block_fetching(struct block_map *map,
+               size_t i)
+{
+        return map->fetching[i / 8] & (1 << (i % 8));
+}
+
+static off_t
+block_len(struct block_map *map,
+          size_t i)
+{
+        off_t start = (off_t)i * BLOCK_SIZE;
+
+        if (start + BLOCK_SIZE > map->size)
+                return map->size - start;
+
+        return BLOCK_SIZE;
+}
+
+/* download one block in the cache file */
+static int
+block_fetch(tpath_entry *pe,
+            size_t i)
+{
+        struct block_map *map = pe->blocks;
+        dpl_status_t rc;
+        char *data = NULL;
+        unsigned int len = 0;
+        off_t start;
+        off_t wanted;
+        int ret;
+
+        start = (off_t)i * BLOCK_SIZE;
+        wanted = block_len(map, i);
+
+        LOG(LOG_DEBUG, "%s: fetch block %zu (%lld bytes)",
+            pe->path, i, (long long)wanted);
+
+        rc = dfs_openread_range_timeout(ctx, pe->path, start,
+                                        start + wanted - 1, &data, &len);
+        if (DPL_SUCCESS != rc) {
+                LOG(LOG_ERR, "%s: dfs_openread_range_timeout: %s",
+                    pe->path, dpl_status_str(rc));
+                /* the blocks already written stay valid */
+                ret = DFS_EINTR == rc ? -EINTR : -EIO;
+                goto end;
+        }
+
+        if (len != wanted) {
+                LOG(LOG_ERR, "%s: block %zu: %u bytes received, %lld expected",
+                    pe->path, i, len, (long long)wanted);
+                ret = -EIO;
+                goto end;
+        }
+
+        if (len != pwrite(pe->fd, data, len, start)) {
+                LOG(LOG_ERR, "%s: pwrite(fd=%d, block %zu): %s",
+                    pe->path, pe->fd, i, strerror(errno));
+                ret = errno ? -errno : -EIO;
+                goto end;
+        }
+
+        pthread_mutex_lock(&map->mutex);
+        map->present[i / 8] |= 1 << (i % 8);
+        pthread_mutex_unlock(&map->mutex);
+
+        lru_grow(pe, len);
+
+        ret = 0;
+  end:
+        if (data)
+                free(data);
+
+        return ret;
+}
+
+/* fetch block i unless it is there, or wait for the reader already
+ * fetching it: a block is downloaded, and accounted, once */
+static int
+block_get(tpath_entry *pe,
+          size_t i)
+{
+        struct block_map *map = pe->blocks;
+        int ret;
+
+        pthread_mutex_lock(&map->mutex);
+        while (block_fetching(map, i))
+                pthread_cond_wait(&map->fetched, &map->mutex);
+
+        if (block_present(map, i)) {
+                pthread_mutex_unlock(&map->mutex);
+                return 0;
+        }
+
+        map->fetching[i / 8] |= 1 << (i % 8);
+        pthread_mutex_unlock(&map->mutex);
+
+        ret = block_fetch(pe, i);
+
+        /* on failure, a waiter tries on its own */
+        pthread_mutex_lock(&map->mutex);
+        map->fetching[i / 8] &= ~(1 << (i % 8));
+        pthread_cond_broadcast(&map->fetched);
+        pthread_mutex_unlock(&map->mutex);
+
+        return ret;
+}
+
+int
+block_acquire(tpath_entry *pe,
+              off_t offset,
+              size_t size)
+{
+        struct block_map *map = NULL;
+        size_t first;
+        size_t last;
+        size_t i;
+        off_t end;
+        time_t now;
+        int ret;
+
+        assert(pe);
+        assert(pe->blocks);
+
+        map = pe->blocks;
+        now = time(NULL);
+
+        pthread_rwlock_rdlock(&map->punch_lock);
+
+        /* past the remote end: what was written locally, if anything */
+        if (map->full || ! size || offset >= map->size)
+                return 0;
+
+        end = offset + size;
+        if (end > map->size)
+                end = map->size;
+
+        first = offset / BLOCK_SIZE;
+        last = (end - 1) / BLOCK_SIZE;
+
+        for (i = first; i <= last; i++) {
+                pthread_mutex_lock(&map->mutex);
+                map->atime[i] = now;
+                pthread_mutex_unlock(&map->mutex);
+
+                ret = block_get(pe, i);
+                if (ret < 0) {
+                        pthread_rwlock_unlock(&map->punch_lock);
+                        return ret;
+                }
+        }
+
+        return 0;
+}
+
+void
+block_release(tpath_entry *pe)
+{
+        assert(pe);
+        assert(pe->blocks);
+
+        pthread_rwlock_unlock(&pe->blocks->punch_lock);
+}
+
+int
+block_fill(tpath_entry *pe)
+{
+        struct block_map *map = NULL;
+        size_t i;
+        int ret = 0;
+
+        assert(pe);
+        assert(pe->blocks);
+
+        map = pe->blocks;
+
+        pthread_rwlock_wrlock(&map->punch_lock);
+
+        if (map->full)
+                goto end;
+
+        for (i = 0; i < map->nblocks; i++) {
+                ret = block_get(pe, i);
+                if (ret < 0)
+                        goto end;
+        }
+
+        map->full = 1;
+  end:
+        pthread_rwlock_unlock(&map->punch_lock);
+
+        return ret;
+}
+
+static int
+cold_block_cmp(const void *a,
+               const void *b)
+{
+        const struct cold_block *ca = a;
+        const struct cold_block *cb = b;
+
+        if (ca->atime != cb->atime)
+                return ca->atime < cb->atime ? -1 : 1;
+
+        return ca->index < cb->index ? -1 : ca->index > cb->index;
+}
+
+off_t
+block_punch(tpath_entry *pe,
+            time_t before,
+            off_t need)
+{
+        struct block_map *map = NULL;
+        struct cold_block *cold = NULL;
+        size_t ncold = 0;
+        size_t i;
+        size_t k;
+        off_t freed = 0;
+        off_t len;
+
+        assert(pe);
+
+        map = pe->blocks;
+        if (! map || map->full || map->nopunch || -1 == pe->fd)
+                return 0;
+
+        /* someone is reading this file, try later */
+        if (pthread_rwlock_trywrlock(&map->punch_lock))
+                return 0;
+
+        cold = malloc(map->nblocks * sizeof *cold);
+        if (! cold) {
+                LOG(LOG_ERR, "malloc: %s", strerror(errno));
+                goto end;
+        }
+
+        for (i = 0; i < map->nblocks; i++) {
+                if (! block_present(map, i) || map->atime[i] >= before)
+                        continue;
+                cold[ncold].atime = map->atime[i];
+                cold[ncold].index = i;
+                ncold++;
+        }
+
+        qsort(cold, ncold, sizeof *cold, cold_block_cmp);
+
+        for (k = 0; k < ncold && freed < need; k++) {
+                i = cold[k].index;
+                len = block_len(map, i);
+
+                if (-1 == fallocate(pe->fd,
+                                    FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE,
+                                    (off_t)i * BLOCK_SIZE, len)) {
+                        if (EOPNOTSUPP == errno) {
+                                LOG(LOG_NOTICE, "%s: can't punch holes in the "
+                                    "cache filesystem", pe->path);
+                                map->nopunch = 1;
+                        } else {
+                                LOG(LOG_ERR, "%s: fallocate(block %zu): %s",
+                                    pe->path, i, strerror(errno));
+                        }
+                        break;
+                }
+
+                map->present[i / 8] &= ~(1 << (i % 8));
+                freed += len;
+        }
+
+        LOG(LOG_INFO, "%s: %zu cold blocks, %lld bytes punched",
+            pe->path, ncold, (long long)freed);
+
+  end:
+        free(cold);
+        pthread_rwlock_unlock(&map->punch_lock);
+
+        return freed;
+}
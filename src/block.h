@@ -0,0 +1,42 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <time.h>
+#include <pthread.h>
+
+#include "hash.h"
+
+#define BLOCK_SIZE (1024 * 1024)
+
+/* Which blocks of a sparse cache file are on disk, and when they were last
+ * read. Missing blocks are fetched with range requests, cold ones are
+ * given back to the filesystem by punching holes. */
+struct block_map {
+        off_t size; /* of the remote object */
+        size_t nblocks;
+        unsigned char *present; /* one bit per block */
+        unsigned char *fetching; /* one bit per block being downloaded */
+        time_t *atime;
+        int full; /* opened for writing: every block stays on disk */
+        int nopunch; /* the cache filesystem can't punch holes */
+        pthread_rwlock_t punch_lock; /* I/O (read) vs hole punching (write) */
+        pthread_mutex_t mutex; /* present, fetching and atime */
+        pthread_cond_t fetched; /* a fetching bit was cleared */
+};
+
+struct block_map *block_map_new(off_t);
+void block_map_free(struct block_map *);
+
+/* make sure the range is in the cache file, fetching the missing blocks;
+ * on success no hole can be punched in the file until block_release() */
+int block_acquire(tpath_entry *, off_t, size_t);
+void block_release(tpath_entry *);
+
+/* fetch every missing block, and never punch this file again */
+int block_fill(tpath_entry *);
+
+/* punch the coldest blocks not read since `before', up to about `need'
+ * bytes, and return the number of bytes released */
+off_t block_punch(tpath_entry *, time_t, off_t);
+
+#endif /* BLOCK_H */
@@ -0,0 +1,372 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "breaker.h"
+#include "endpoint.h"
+#include "hash.h"
+#include "lru.h"
+#include "release.h"
+#include "log.h"
+#include "tmpstr.h"
+
+extern GHashTable *hash;
+extern struct conf *conf;
+
+static pthread_mutex_t breaker_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static volatile int tripped = 0;
+static int failures = 0; /* in a row, all endpoints together */
+static time_t tripped_since = 0;
+static unsigned long long trips = 0;
+static unsigned long long sent = 0; /* queued uploads done */
+static GQueue queued = G_QUEUE_INIT; /* paths to upload, oldest first */
+
+/* no answer at all; a negative one shows the store is there */
+static int
+breaker_failed(dpl_status_t rc)
+{
+        switch (rc) {
+        case DPL_FAILURE:
+        case DPL_ETIMEOUT:
+        case DPL_EIO:
+                return 1;
+        default:
+                return 0;
+        }
+}
+
+int
+breaker_open(void)
+{
+        return tripped;
+}
+
+void
+breaker_record(dpl_status_t rc)
+{
+        if (! conf->offline_failures)
+                return;
+
+        pthread_mutex_lock(&breaker_mutex);
+
+        if (! breaker_failed(rc)) {
+                failures = 0;
+                goto end;
+        }
+
+        failures++;
+        if (tripped || failures < conf->offline_failures)
+                goto end;
+
+        tripped = 1;
+        tripped_since = time(NULL);
+        trips++;
+
+        LOG(LOG_ERR, "%d failures in a row (%s), the store is out of reach, "
+            "serving from the cache", failures, dpl_status_str(rc));
+  end:
+        pthread_mutex_unlock(&breaker_mutex);
+}
+
+static char *
+breaker_file(void)
+{
+        return tmpstr_printf("%s.queued", conf->cache_dir);
+}
+
+/* called with breaker_mutex held; the queue outlives the mount, its cache
+ * files are the only copies */
+static int
+breaker_save(void)
+{
+        FILE *fp = NULL;
+        GList *link = NULL;
+        char *file = NULL;
+        char *tmp = NULL;
+
+        file = breaker_file();
+
+        if (g_queue_is_empty(&queued)) {
+                if (-1 == unlink(file) && ENOENT != errno) {
+                        LOG(LOG_ERR, "unlink(%s): %s", file, strerror(errno));
+                        return -1;
+                }
+                return 0;
+        }
+
+        tmp = tmpstr_printf("%s.tmp", file);
+
+        fp = fopen(tmp, "w");
+        if (! fp) {
+                LOG(LOG_ERR, "fopen(%s): %s", tmp, strerror(errno));
+                return -1;
+        }
+
+        for (link = g_queue_peek_head_link(&queued); link; link = link->next)
+                fprintf(fp, "%s\n", (char *)link->data);
+
+        if (fclose(fp)) {
+                LOG(LOG_ERR, "fclose(%s): %s", tmp, strerror(errno));
+                return -1;
+        }
+
+        if (-1 == rename(tmp, file)) {
+                LOG(LOG_ERR, "rename(%s, %s): %s", tmp, file, strerror(errno));
+                return -1;
+        }
+
+        return 0;
+}
+
+/* a file queued before the last unmount: its dirty cache file is back in
+ * the hashtable, so that it is served and uploaded like the others */
+static int
+breaker_restore(const char *path)
+{
+        tpath_entry *pe = NULL;
+        char *local = NULL;
+        int fd;
+
+        pe = g_hash_table_lookup(hash, path);
+        if (! pe && -1 == populate_hash(hash, path, FILE_REG, &pe)) {
+                LOG(LOG_ERR, "%s: can't add a new cell", path);
+                return -1;
+        }
+
+        local = pentry_cache_path(pe);
+        fd = open(local, O_RDWR);
+        if (-1 == fd) {
+                LOG(LOG_ERR, "%s: %s, its changes are lost",
+                    local, strerror(errno));
+                return -1;
+        }
+
+        lru_set_fd(pe, fd);
+        pe->flag = FLAG_DIRTY;
+        pe->ondisk = FILE_LOCAL;
+        lru_touch(pe);
+
+        return 0;
+}
+
+static int
+breaker_load(void)
+{
+        FILE *fp = NULL;
+        char *file = NULL;
+        char line[4096];
+        char *nl = NULL;
+        char *copy = NULL;
+        int loaded = 0;
+
+        file = breaker_file();
+        fp = fopen(file, "r");
+        if (! fp) {
+                if (ENOENT == errno)
+                        return 0;
+                LOG(LOG_ERR, "fopen(%s): %s", file, strerror(errno));
+                return -1;
+        }
+
+        while (fgets(line, sizeof line, fp)) {
+                nl = strchr(line, '\n');
+                if (! nl)
+                        continue;
+                *nl = 0;
+
+                if ('/' != line[0] || -1 == breaker_restore(line))
+                        continue;
+
+                copy = strdup(line);
+                if (! copy) {
+                        LOG(LOG_ERR, "%s: strdup: %s, not queued",
+                            line, strerror(errno));
+                        continue;
+                }
+
+                pthread_mutex_lock(&breaker_mutex);
+                g_queue_push_tail(&queued, copy);
+                pthread_mutex_unlock(&breaker_mutex);
+                loaded++;
+        }
+
+        fclose(fp);
+
+        LOG(LOG_NOTICE, "%d uploads queued before the last unmount", loaded);
+
+        return 0;
+}
+
+void
+breaker_queue(const char *path)
+{
+        char *copy = NULL;
+
+        pthread_mutex_lock(&breaker_mutex);
+
+        if (g_queue_find_custom(&queued, path, (GCompareFunc)strcmp))
+                goto end;
+
+        copy = strdup(path);
+        if (! copy) {
+                LOG(LOG_ERR, "%s: strdup: %s, not queued",
+                    path, strerror(errno));
+                goto end;
+        }
+
+        g_queue_push_tail(&queued, copy);
+        LOG(LOG_NOTICE, "%s: upload queued (%u waiting)",
+            path, g_queue_get_length(&queued));
+        (void)breaker_save();
+  end:
+        pthread_mutex_unlock(&breaker_mutex);
+}
+
+/* called by the probe thread only */
+static int
+breaker_alive(void)
+{
+        struct endpoint *ep = NULL;
+        dpl_dict_t *metadata = NULL;
+        dpl_status_t rc;
+
+        ep = endpoint_get();
+        rc = dpl_getattr(endpoint_ctx(ep), "/", &metadata);
+        endpoint_put(ep, rc, NULL);
+        if (metadata)
+                dpl_dict_free(metadata);
+
+        LOG(LOG_DEBUG, "probe: %s", dpl_status_str(rc));
+
+        return ! breaker_failed(rc);
+}
+
+/* send what was closed while the store was away, one file at a time; a
+ * file still open goes back to the queue */
+static void
+breaker_drain(void)
+{
+        char *path = NULL;
+        unsigned n;
+
+        pthread_mutex_lock(&breaker_mutex);
+        n = g_queue_get_length(&queued);
+        pthread_mutex_unlock(&breaker_mutex);
+
+        while (n-- && ! tripped) {
+                pthread_mutex_lock(&breaker_mutex);
+                path = g_queue_pop_head(&queued);
+                pthread_mutex_unlock(&breaker_mutex);
+
+                if (! path)
+                        break;
+
+                if (-1 == dfs_upload_queued(path))
+                        breaker_queue(path);
+                else
+                        sent++;
+
+                free(path);
+        }
+
+        pthread_mutex_lock(&breaker_mutex);
+        (void)breaker_save();
+        pthread_mutex_unlock(&breaker_mutex);
+}
+
+static void *
+thread_probe(void *arg)
+{
+        (void)arg;
+
+        for (;;) {
+                sleep(conf->offline_probe_delay > 0 ?
+                      conf->offline_probe_delay : 1);
+
+                if (tripped) {
+                        if (! breaker_alive())
+                                continue;
+
+                        pthread_mutex_lock(&breaker_mutex);
+                        tripped = 0;
+                        failures = 0;
+                        LOG(LOG_ERR, "the store is back after %ds, %u "
+                            "uploads queued", (int)(time(NULL) - tripped_since),
+                            g_queue_get_length(&queued));
+                        pthread_mutex_unlock(&breaker_mutex);
+                }
+
+                breaker_drain();
+        }
+
+        return NULL;
+}
+
+int
+breaker_init(void)
+{
+        pthread_t id;
+        pthread_attr_t attr;
+        int ret;
+
+        /* even with the offline mode off now, what it queued is sent */
+        (void)breaker_load();
+
+        if (! conf->offline_failures && g_queue_is_empty(&queued))
+                return 0;
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        ret = pthread_create(&id, &attr, thread_probe, NULL);
+        pthread_attr_destroy(&attr);
+        if (ret) {
+                LOG(LOG_ERR, "pthread_create: %s", strerror(ret));
+                conf->offline_failures = 0;
+                return -1;
+        }
+
+        return 0;
+}
+
+void
+breaker_stop(void)
+{
+        char *path = NULL;
+
+        pthread_mutex_lock(&breaker_mutex);
+
+        if (-1 == breaker_save())
+                LOG(LOG_ERR, "can't save the queue, it won't be sent at the "
+                    "next mount");
+
+        while ((path = g_queue_pop_head(&queued))) {
+                LOG(LOG_ERR, "%s: not uploaded yet, sent at the next mount",
+                    path);
+                free(path);
+        }
+
+        pthread_mutex_unlock(&breaker_mutex);
+}
+
+char *
+breaker_stats(void)
+{
+        char *stats = NULL;
+
+        pthread_mutex_lock(&breaker_mutex);
+
+        stats = tmpstr_printf("%s failures=%d trips=%llu queued=%u sent=%llu",
+                              tripped ? "offline" : "online", failures, trips,
+                              g_queue_get_length(&queued), sent);
+
+        pthread_mutex_unlock(&breaker_mutex);
+
+        return stats;
+}
@@ -0,0 +1,28 @@
+#ifndef BREAKER_H
+#define BREAKER_H
+
+#include <droplet.h>
+
+/* The object store as a whole, out of reach after too many failures in a
+ * row.  Then the requests fail at once instead of waiting for it, what is
+ * cached is served as is and the closed files wait in a queue; a probe
+ * thread brings the store back and sends the queue.  The queue is saved
+ * in <cache_dir>.queued, and sent again after a remount. */
+
+/* load the queue of the last mount, start the probe thread, return 0 or
+ * -1 */
+int breaker_init(void);
+/* save what was never sent */
+void breaker_stop(void);
+
+/* 1 while the store is out of reach */
+int breaker_open(void);
+/* the answer of a request to the store */
+void breaker_record(dpl_status_t);
+/* upload the cache file of this path once the store is back */
+void breaker_queue(const char *);
+
+/* its state, in a temporary string */
+char *breaker_stats(void);
+
+#endif /* BREAKER_H */
@@ -16,6 +16,8 @@
 #include "timeout.h"
 #include "file.h"
 #include "list.h"
+#include "ram.h"
+#include "throttle.h"
 
 #define MAX_CHILDREN 30
 
@@ -25,6 +27,31 @@ extern GHashTable *hash;
 
 GThreadPool *pool;
 
+/* the remote object was modified behind our back: the next open has to
+ * revalidate the cache file, and the kernel has to drop its page cache */
+static void
+check_remote_change(tpath_entry *pe,
+                    dpl_dict_t *usermd)
+{
+        if (FILE_LOCAL != pe->ondisk)
+                return;
+
+        if (pentry_get_refcount(pe))
+                return;
+
+        /* closed while the store was out of reach, ours is the newest */
+        if (FLAG_DIRTY == pe->flag)
+                return;
+
+        if (! pentry_usermd_changed(pe, usermd))
+                return;
+
+        LOG(LOG_INFO, "%s: remote object changed, invalidate", pe->path);
+        pe->flag = FLAG_STALE;
+        pe->keep_cache = 0;
+        ram_drop(pe);
+}
+
 static void
 cb_map_dirents(void *elem, void *cb_arg)
 {
@@ -69,8 +96,10 @@ cb_map_dirents(void *elem, void *cb_arg)
         if (pentry_md_trylock(pe_dirent))
                 goto end;
 
-        if (usermd)
+        if (usermd) {
+                check_remote_change(pe_dirent, usermd);
                 pentry_set_usermd(pe_dirent, usermd);
+        }
 
         pe_dirent->atime = time(NULL);
 
@@ -97,6 +126,8 @@ update_md(gpointer data,
 
         LOG(LOG_DEBUG, "path=%s", pe->path);
 
+        throttle_set_class(THROTTLE_REVALIDATE);
+
         ino = dpl_cwd(ctx, ctx->cur_bucket);
 
         rc = dfs_namei_timeout(ctx, pe->path, ctx->cur_bucket,
@@ -122,8 +153,10 @@ update_md(gpointer data,
         if (pentry_md_trylock(pe))
                 goto end;
 
-        if (usermd)
+        if (usermd) {
+                check_remote_change(pe, usermd);
                 pentry_set_usermd(pe, usermd);
+        }
 
         pe->atime = time(NULL);
 
@@ -174,6 +207,8 @@ cb_get_md(gpointer data,
 
         LOG(LOG_DEBUG, "starting a new thread for rootdir md update");
 
+        throttle_set_class(THROTTLE_REVALIDATE);
+
         memset(&stbuf, 0, sizeof stbuf);
         (void)dfs_getattr(path, &stbuf);
 }
@@ -208,13 +243,7 @@ root_dir_preload(GThreadPool *pool,
                 g_hash_table_insert(hash, key, pe);
         }
 
-        rc = dfs_chdir_timeout(ctx, root_dir);
-        if (DPL_SUCCESS != rc) {
-                LOG(LOG_ERR, "dfs_chdir_timeout: %s", dpl_status_str(rc));
-                goto err;
-        }
-
-        rc = dfs_opendir_timeout(ctx, ".", &dir_hdl);
+        rc = dfs_opendir_timeout(ctx, root_dir, &dir_hdl);
         if (DPL_SUCCESS != rc) {
                 LOG(LOG_ERR, "dfs_opendir_timeout: %s", dpl_status_str(rc));
                 goto err;
@@ -243,6 +272,8 @@ thread_cachedir(void *cb_arg)
         if (! conf->sc_loop_delay || ! conf->sc_age_threshold)
                 return NULL;
 
+        throttle_set_class(THROTTLE_REVALIDATE);
+
         pool = g_thread_pool_new(cb_get_md, NULL, 50, FALSE, &err);
         if (err) {
                 LOG(LOG_ERR, "thread pool creation: %s", err->message);
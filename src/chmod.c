@@ -18,6 +18,8 @@ dfs_chmod(const char *path,
 {
         dpl_status_t rc;
         int ret;
+        int fd;
+        int status;
         tpath_entry *pe = NULL;
         time_t now;
 
@@ -40,16 +42,24 @@ dfs_chmod(const char *path,
         assign_meta_to_dict(pe->usermd, "ctime", (unsigned long)now);
         pentry_md_unlock(pe);
 
-        if (-1 != pe->fd && FILE_LOCAL == pe->ondisk) {
-                /* change the cache file info */
-                if (-1 == fchmod(pe->fd, mode)) {
-                        if (EPERM != errno) {
-                                LOG(LOG_ERR, "fchmod(fd=%d, mode=%d): %s (%d)",
-                                    pe->fd, (int) mode, strerror(errno), errno);
-                                ret = -1;
-                                goto err;
-                        }
+        if (FILE_LOCAL == pe->ondisk) {
+                /* change the cache file info, by its name if the descriptor
+                 * is parked or busy */
+                fd = pentry_fd_get(pe);
+                if (-1 == fd)
+                        status = chmod(pentry_cache_path(pe), mode);
+                else
+                        status = fchmod(fd, mode);
+                if (-1 == status && EPERM != errno && ENOENT != errno) {
+                        LOG(LOG_ERR, "chmod(fd=%d, mode=%d): %s (%d)",
+                            fd, (int) mode, strerror(errno), errno);
+                        if (-1 != fd)
+                                pentry_fd_put(pe);
+                        ret = -1;
+                        goto err;
                 }
+                if (-1 != fd)
+                        pentry_fd_put(pe);
         }
 
         /* update metadata on the cloud */
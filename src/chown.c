@@ -20,6 +20,8 @@ dfs_chown(const char *path,
 {
         dpl_status_t rc;
         int ret;
+        int fd;
+        int status;
         tpath_entry *pe = NULL;
         time_t now;
 
@@ -44,18 +46,24 @@ dfs_chown(const char *path,
         assign_meta_to_dict(pe->usermd, "gid", (unsigned long) gid);
         pentry_md_unlock(pe);
 
-        if (-1 != pe->fd && FILE_LOCAL == pe->ondisk) {
-                /* change the cache file info */
-                if (-1 == fchown(pe->fd, uid, gid)) {
-                        if (EPERM != errno) {
-                                LOG(LOG_ERR,
-                                    "fchown(fd=%d, uid=%d, gid=%d): %s (%d)",
-                                    pe->fd, (int) uid, (int) gid,
-                                    strerror(errno), errno);
-                                ret = -1;
-                                goto err;
-                        }
+        if (FILE_LOCAL == pe->ondisk) {
+                /* change the cache file info, by its name if the descriptor
+                 * is parked or busy */
+                fd = pentry_fd_get(pe);
+                if (-1 == fd)
+                        status = chown(pentry_cache_path(pe), uid, gid);
+                else
+                        status = fchown(fd, uid, gid);
+                if (-1 == status && EPERM != errno && ENOENT != errno) {
+                        LOG(LOG_ERR, "chown(fd=%d, uid=%d, gid=%d): %s (%d)",
+                            fd, (int) uid, (int) gid, strerror(errno), errno);
+                        if (-1 != fd)
+                                pentry_fd_put(pe);
+                        ret = -1;
+                        goto err;
                 }
+                if (-1 != fd)
+                        pentry_fd_put(pe);
         }
 
         rc = dfs_setattr_timeout(ctx, path, pe->usermd);
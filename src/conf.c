@@ -5,6 +5,7 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/resource.h>
 #include <syslog.h>
 
 #include "conf.h"
@@ -17,6 +18,8 @@
 #define DEFAULT_ZLIB_LEVEL 3 /* from 0 to 9 */
 #define DEFAULT_CACHE_DIR "/tmp"
 #define DEFAULT_MAX_RETRY 5
+#define DEFAULT_RETRY_DEADLINE 15 /* seconds, all attempts of a metadata request */
+#define DEFAULT_RETRY_DATA_DEADLINE 120 /* seconds, same for a data transfer */
 #define DEFAULT_GC_LOOP_DELAY 60 /* 'garbage collector', in seconds */
 #define DEFAULT_GC_AGE_THRESHOLD 900 /* seconds */
 #define DEFAULT_SC_LOOP_DELAY 0 /* 'smart cache', in seconds */
@@ -26,6 +29,25 @@
 #define DEFAULT_EXCLUSION_REGEXP NULL
 #define DEFAULT_CACHE_MAX_SIZE (10*1024*1024) /* 10MB */
 #define DEFAULT_ENCRYPTION_METHOD "NONE" /* "NONE" or "AES" */
+#define DEFAULT_CACHE_LAYOUT "TREE" /* "TREE" or "FLAT" */
+#define DEFAULT_DISK_CACHE_SIZE 0 /* bytes, no limit */
+#define DEFAULT_DISK_CACHE_MIN_FREE 5 /* percent of the cache filesystem */
+#define DEFAULT_TRACE_MAX_FILES 1000
+#define DEFAULT_PREFETCH_THREADS 4
+#define DEFAULT_DELETE_THREADS 0
+#define DEFAULT_RENAME_THREADS 16
+#define DEFAULT_HEDGE_PERCENTILE 0 /* no hedging */
+#define DEFAULT_HEDGE_BUDGET 5 /* percent of the requests */
+#define DEFAULT_MAX_INFLIGHT 64
+#define DEFAULT_ENDPOINTS NULL /* the host of the droplet profile */
+#define DEFAULT_OFFLINE_FAILURES 10 /* in a row */
+#define DEFAULT_OFFLINE_PROBE_DELAY 5 /* seconds */
+#define DEFAULT_RAM_CACHE_SIZE (64 * 1024 * 1024) /* bytes */
+#define DEFAULT_RAM_CACHE_MAX_FILE (64 * 1024) /* bytes */
+#define DEFAULT_SPARSE_CACHE_MIN_SIZE (256 * 1024 * 1024) /* bytes */
+#define DEFAULT_MAX_OPEN_FILES 512 /* if RLIMIT_NOFILE is unknown */
+#define DEFAULT_ATTR_TIMEOUT 1 /* seconds, same as libfuse */
+#define DEFAULT_ENTRY_TIMEOUT 1 /* seconds, same as libfuse */
 
 #define COMPRESSION_METHOD "compression_method"
 #define COMPRESSION_METHOD_LEN strlen(COMPRESSION_METHOD)
@@ -33,6 +55,10 @@
 #define ZLIB_LEVEL_LEN strlen(ZLIB_LEVEL)
 #define MAX_RETRY "max_retry"
 #define MAX_RETRY_LEN strlen(MAX_RETRY)
+#define RETRY_DEADLINE "retry_deadline"
+#define RETRY_DEADLINE_LEN strlen(RETRY_DEADLINE)
+#define RETRY_DATA_DEADLINE "retry_data_deadline"
+#define RETRY_DATA_DEADLINE_LEN strlen(RETRY_DATA_DEADLINE)
 #define GC_LOOP_DELAY "gc_loop_delay"
 #define GC_LOOP_DELAY_LEN strlen(GC_LOOP_DELAY)
 #define GC_AGE_THRESHOLD "gc_age_threshold"
@@ -51,6 +77,44 @@
 #define CACHE_MAX_SIZE_LEN strlen(CACHE_MAX_SIZE)
 #define ENCRYPTION_METHOD "encryption_method"
 #define ENCRYPTION_METHOD_LEN strlen(ENCRYPTION_METHOD)
+#define CACHE_LAYOUT "cache_layout"
+#define CACHE_LAYOUT_LEN strlen(CACHE_LAYOUT)
+#define DISK_CACHE_SIZE "disk_cache_size"
+#define DISK_CACHE_SIZE_LEN strlen(DISK_CACHE_SIZE)
+#define DISK_CACHE_MIN_FREE "disk_cache_min_free"
+#define DISK_CACHE_MIN_FREE_LEN strlen(DISK_CACHE_MIN_FREE)
+#define MAX_OPEN_FILES "max_open_files"
+#define MAX_OPEN_FILES_LEN strlen(MAX_OPEN_FILES)
+#define SPARSE_CACHE_MIN_SIZE "sparse_cache_min_size"
+#define SPARSE_CACHE_MIN_SIZE_LEN strlen(SPARSE_CACHE_MIN_SIZE)
+#define TRACE_MAX_FILES "trace_max_files"
+#define TRACE_MAX_FILES_LEN strlen(TRACE_MAX_FILES)
+#define PREFETCH_THREADS "prefetch_threads"
+#define PREFETCH_THREADS_LEN strlen(PREFETCH_THREADS)
+#define DELETE_THREADS "delete_threads"
+#define DELETE_THREADS_LEN strlen(DELETE_THREADS)
+#define RENAME_THREADS "rename_threads"
+#define RENAME_THREADS_LEN strlen(RENAME_THREADS)
+#define HEDGE_PERCENTILE "hedge_percentile"
+#define HEDGE_PERCENTILE_LEN strlen(HEDGE_PERCENTILE)
+#define HEDGE_BUDGET "hedge_budget"
+#define HEDGE_BUDGET_LEN strlen(HEDGE_BUDGET)
+#define MAX_INFLIGHT "max_inflight"
+#define MAX_INFLIGHT_LEN strlen(MAX_INFLIGHT)
+#define ENDPOINTS "endpoints"
+#define ENDPOINTS_LEN strlen(ENDPOINTS)
+#define OFFLINE_FAILURES "offline_failures"
+#define OFFLINE_FAILURES_LEN strlen(OFFLINE_FAILURES)
+#define OFFLINE_PROBE_DELAY "offline_probe_delay"
+#define OFFLINE_PROBE_DELAY_LEN strlen(OFFLINE_PROBE_DELAY)
+#define RAM_CACHE_SIZE "ram_cache_size"
+#define RAM_CACHE_SIZE_LEN strlen(RAM_CACHE_SIZE)
+#define RAM_CACHE_MAX_FILE "ram_cache_max_file"
+#define RAM_CACHE_MAX_FILE_LEN strlen(RAM_CACHE_MAX_FILE)
+#define ATTR_TIMEOUT "attr_timeout"
+#define ATTR_TIMEOUT_LEN strlen(ATTR_TIMEOUT)
+#define ENTRY_TIMEOUT "entry_timeout"
+#define ENTRY_TIMEOUT_LEN strlen(ENTRY_TIMEOUT)
 
 extern dpl_ctx_t *ctx;
 
@@ -127,6 +191,12 @@ conf_free(struct conf *conf)
         if (conf->encryption_method)
                 free(conf->encryption_method);
 
+        if (conf->cache_layout)
+                free(conf->cache_layout);
+
+        if (conf->endpoints)
+                free(conf->endpoints);
+
         if (conf->cache_dir)
                 free(conf->cache_dir);
 
@@ -241,6 +311,35 @@ parse_int(int *field,
         return ret;
 }
 
+static int
+parse_ull(unsigned long long *field,
+          char *line)
+{
+        int ret;
+        char *p = NULL;
+
+        /* remove leading garbage */
+        p = strchr(line, '=');
+        if (! p) {
+                fprintf(stderr, "missing assignation in line \"%s\"\n", line);
+                ret = -1;
+                goto err;
+        }
+
+        /* skip the '=' */
+        p++;
+
+        while (p && *p && isspace(*p))
+                p++;
+
+        if (field)
+                *field = strtoull(p, NULL, 10);
+
+        ret = 0;
+  err:
+        return ret;
+}
+
 static int
 parse_str(char **field,
           char *line)
@@ -353,6 +452,13 @@ parse_token(struct conf * conf,
                 }
         }
 
+        if (! strncasecmp(token, CACHE_LAYOUT, CACHE_LAYOUT_LEN)) {
+                if (-1 == parse_str(&conf->cache_layout, token)) {
+                        ret = -1;
+                        goto err;
+                }
+        }
+
         if (! strncasecmp(token, ENCRYPTION_METHOD, ENCRYPTION_METHOD_LEN)) {
                 if (-1 == parse_str(&conf->encryption_method, token)) {
                         ret = -1;
@@ -367,6 +473,146 @@ parse_token(struct conf * conf,
                 }
         }
 
+        if (! strncasecmp(token, DISK_CACHE_SIZE, DISK_CACHE_SIZE_LEN)) {
+                if (-1 == parse_ull(&conf->disk_cache_size, token)) {
+                        ret = -1;
+                        goto err;
+                }
+        }
+
+        if (! strncasecmp(token, DISK_CACHE_MIN_FREE, DISK_CACHE_MIN_FREE_LEN)) {
+                if (-1 == parse_int(&conf->disk_cache_min_free, token)) {
+                        ret = -1;
+                        goto err;
+                }
+        }
+
+        if (! strncasecmp(token, TRACE_MAX_FILES, TRACE_MAX_FILES_LEN)) {
+                if (-1 == parse_int(&conf->trace_max_files, token)) {
+                        ret = -1;
+                        goto err;
+                }
+        }
+
+        if (! strncasecmp(token, RETRY_DEADLINE, RETRY_DEADLINE_LEN)) {
+                if (-1 == parse_int(&conf->retry_deadline, token)) {
+                        ret = -1;
+                        goto err;
+                }
+        }
+
+        if (! strncasecmp(token, RETRY_DATA_DEADLINE, RETRY_DATA_DEADLINE_LEN)) {
+                if (-1 == parse_int(&conf->retry_data_deadline, token)) {
+                        ret = -1;
+                        goto err;
+                }
+        }
+
+        if (! strncasecmp(token, PREFETCH_THREADS, PREFETCH_THREADS_LEN)) {
+                if (-1 == parse_int(&conf->prefetch_threads, token)) {
+                        ret = -1;
+                        goto err;
+                }
+        }
+
+        if (! strncasecmp(token, DELETE_THREADS, DELETE_THREADS_LEN)) {
+                if (-1 == parse_int(&conf->delete_threads, token)) {
+                        ret = -1;
+                        goto err;
+                }
+        }
+
+        if (! strncasecmp(token, RENAME_THREADS, RENAME_THREADS_LEN)) {
+                if (-1 == parse_int(&conf->rename_threads, token)) {
+                        ret = -1;
+                        goto err;
+                }
+        }
+
+        if (! strncasecmp(token, HEDGE_PERCENTILE, HEDGE_PERCENTILE_LEN)) {
+                if (-1 == parse_int(&conf->hedge_percentile, token)) {
+                        ret = -1;
+                        goto err;
+                }
+        }
+
+        if (! strncasecmp(token, HEDGE_BUDGET, HEDGE_BUDGET_LEN)) {
+                if (-1 == parse_int(&conf->hedge_budget, token)) {
+                        ret = -1;
+                        goto err;
+                }
+        }
+
+        if (! strncasecmp(token, MAX_INFLIGHT, MAX_INFLIGHT_LEN)) {
+                if (-1 == parse_int(&conf->max_inflight, token)) {
+                        ret = -1;
+                        goto err;
+                }
+        }
+
+        if (! strncasecmp(token, ENDPOINTS, ENDPOINTS_LEN)) {
+                if (-1 == parse_str(&conf->endpoints, token)) {
+                        ret = -1;
+                        goto err;
+                }
+        }
+
+        if (! strncasecmp(token, OFFLINE_FAILURES, OFFLINE_FAILURES_LEN)) {
+                if (-1 == parse_int(&conf->offline_failures, token)) {
+                        ret = -1;
+                        goto err;
+                }
+        }
+
+        if (! strncasecmp(token, OFFLINE_PROBE_DELAY, OFFLINE_PROBE_DELAY_LEN)) {
+                if (-1 == parse_int(&conf->offline_probe_delay, token)) {
+                        ret = -1;
+                        goto err;
+                }
+        }
+
+        if (! strncasecmp(token, RAM_CACHE_SIZE, RAM_CACHE_SIZE_LEN)) {
+                if (-1 == parse_ull(&conf->ram_cache_size, token)) {
+                        ret = -1;
+                        goto err;
+                }
+        }
+
+        if (! strncasecmp(token, RAM_CACHE_MAX_FILE, RAM_CACHE_MAX_FILE_LEN)) {
+                if (-1 == parse_int(&conf->ram_cache_max_file, token)) {
+                        ret = -1;
+                        goto err;
+                }
+        }
+
+        if (! strncasecmp(token, SPARSE_CACHE_MIN_SIZE, SPARSE_CACHE_MIN_SIZE_LEN)) {
+                if (-1 == parse_ull(&conf->sparse_cache_min_size, token)) {
+                        ret = -1;
+                        goto err;
+                }
+        }
+
+        if (! strncasecmp(token, MAX_OPEN_FILES, MAX_OPEN_FILES_LEN)) {
+                if (-1 == parse_int(&conf->max_open_files, token)) {
+                        ret = -1;
+                        goto err;
+                }
+        }
+
+        if (! strncasecmp(token, ATTR_TIMEOUT, ATTR_TIMEOUT_LEN)) {
+                if (-1 == parse_int(&conf->attr_timeout, token)) {
+                        ret = -1;
+                        goto err;
+                }
+        }
+
+        if (! strncasecmp(token, ENTRY_TIMEOUT, ENTRY_TIMEOUT_LEN)) {
+                if (-1 == parse_int(&conf->entry_timeout, token)) {
+                        ret = -1;
+                        goto err;
+                }
+        }
+
         if (! strncasecmp(token, LOG_LEVEL, LOG_LEVEL_LEN)) {
                 if (-1 == parse_str(&log, token)) {
                         fprintf(stderr, "can't parse log_level line: \"%s\"\n",
@@ -464,6 +710,18 @@ parse_file(struct conf * conf,
         return ret;
 }
 
+/* keep half of the descriptors we are allowed for the cache files */
+static int
+default_max_open_files(void)
+{
+        struct rlimit rl;
+
+        if (-1 == getrlimit(RLIMIT_NOFILE, &rl) || RLIM_INFINITY == rl.rlim_cur)
+                return DEFAULT_MAX_OPEN_FILES;
+
+        return rl.rlim_cur / 2;
+}
+
 static int
 conf_ctor_default(struct conf *conf,
                   char *root_dir)
@@ -493,14 +751,40 @@ conf_ctor_default(struct conf *conf,
                 goto err;
         }
 
+        conf->cache_layout = strdup(DEFAULT_CACHE_LAYOUT);
+        if (! conf->cache_layout) {
+                ret = -1;
+                goto err;
+        }
+
         conf->zlib_level = DEFAULT_ZLIB_LEVEL;
         conf->gc_loop_delay = DEFAULT_GC_LOOP_DELAY;
         conf->gc_age_threshold = DEFAULT_GC_AGE_THRESHOLD;
         conf->sc_loop_delay = DEFAULT_SC_LOOP_DELAY;
         conf->sc_age_threshold = DEFAULT_SC_AGE_THRESHOLD;
         conf->max_retry = DEFAULT_MAX_RETRY;
+        conf->retry_deadline = DEFAULT_RETRY_DEADLINE;
+        conf->retry_data_deadline = DEFAULT_RETRY_DATA_DEADLINE;
         conf->log_level = DEFAULT_LOG_LEVEL;
         conf->cache_max_size = DEFAULT_CACHE_MAX_SIZE;
+        conf->disk_cache_size = DEFAULT_DISK_CACHE_SIZE;
+        conf->disk_cache_min_free = DEFAULT_DISK_CACHE_MIN_FREE;
+        conf->max_open_files = default_max_open_files();
+        conf->sparse_cache_min_size = DEFAULT_SPARSE_CACHE_MIN_SIZE;
+        conf->ram_cache_size = DEFAULT_RAM_CACHE_SIZE;
+        conf->ram_cache_max_file = DEFAULT_RAM_CACHE_MAX_FILE;
+        conf->trace_max_files = DEFAULT_TRACE_MAX_FILES;
+        conf->prefetch_threads = DEFAULT_PREFETCH_THREADS;
+        conf->delete_threads = DEFAULT_DELETE_THREADS;
+        conf->rename_threads = DEFAULT_RENAME_THREADS;
+        conf->hedge_percentile = DEFAULT_HEDGE_PERCENTILE;
+        conf->hedge_budget = DEFAULT_HEDGE_BUDGET;
+        conf->max_inflight = DEFAULT_MAX_INFLIGHT;
+        conf->endpoints = DEFAULT_ENDPOINTS;
+        conf->offline_failures = DEFAULT_OFFLINE_FAILURES;
+        conf->offline_probe_delay = DEFAULT_OFFLINE_PROBE_DELAY;
+        conf->attr_timeout = DEFAULT_ATTR_TIMEOUT;
+        conf->entry_timeout = DEFAULT_ENTRY_TIMEOUT;
         re_ctor(&conf->regex, NULL, REG_EXTENDED);
 
         ret = 0;
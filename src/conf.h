@@ -6,6 +6,7 @@
 struct conf {
         char *root_dir; /* the mountpoint */
         char *cache_dir; /* cache directory */
+        char *cache_layout; /* "tree" or "flat" */
         char *compression_method; /* "zlib" or "none" */
         int zlib_level; /* from 1 to 9 */
         int gc_loop_delay; /* in seconds */
@@ -13,8 +14,28 @@ struct conf {
         int sc_loop_delay; /* in seconds */
         int sc_age_threshold; /* in seconds */
         int max_retry; /* before a timeout */
+        int retry_deadline; /* metadata requests, in seconds */
+        int retry_data_deadline; /* data transfers, in seconds */
         int log_level; /* from sys/syslog.h */
         int cache_max_size; /* in bytes */
+        unsigned long long disk_cache_size; /* in bytes, 0 means no limit */
+        int disk_cache_min_free; /* percent of the cache filesystem */
+        int max_open_files; /* cache file descriptors kept open */
+        unsigned long long sparse_cache_min_size; /* cached by blocks above */
+        unsigned long long ram_cache_size; /* memory tier, in bytes */
+        int ram_cache_max_file; /* bigger files stay on disk only */
+        int trace_max_files; /* recorded and prefetched at mount */
+        int prefetch_threads;
+        int delete_threads; /* background removals, 0 means one at a time */
+        int rename_threads; /* copies of a directory rename, 0 means one at a time */
+        int hedge_percentile; /* of the latencies, 0 means no hedging */
+        int hedge_budget; /* hedges per 100 requests */
+        int max_inflight; /* requests to the store, 0 means no limit */
+        char *endpoints; /* "host:port,host:port", NULL for the profile */
+        int offline_failures; /* in a row before going offline, 0 means never */
+        int offline_probe_delay; /* between two probes when offline, in seconds */
+        int attr_timeout; /* kernel attribute cache, in seconds */
+        int entry_timeout; /* kernel name lookup cache, in seconds */
         struct re regex; /* do not upload files matching this regex */
         char *encryption_method; /* "aes" or "none" */
         int debug;
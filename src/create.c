@@ -10,6 +10,8 @@
 #include "hash.h"
 #include "regex.h"
 #include "timeout.h"
+#include "breaker.h"
+#include "delete.h"
 
 extern struct conf *conf;
 extern dpl_ctx_t *ctx;
@@ -27,6 +29,7 @@ dfs_create(const char *path,
         struct stat st;
         dpl_dict_t *usermd = NULL;
         int exclude;
+        int offline;
 
         LOG(LOG_DEBUG, "%s, mode=0x%x, %s",
             path, (unsigned)mode, flags_to_str(info->flags));
@@ -37,9 +40,17 @@ dfs_create(const char *path,
                 goto err;
         }
 
+        /* the removal of a previous file of this name must not take the
+         * new one with it */
+        (void)delete_flush(path);
+
         exclude = re_matcher(&conf->regex, path);
 
-        if (! exclude) {
+        /* the store is out of reach: the new file is only created in the
+         * cache, its upload is queued on release */
+        offline = breaker_open();
+
+        if (! exclude && ! offline) {
                 ino = dpl_cwd(ctx, ctx->cur_bucket);
 
                 rc = dfs_namei_timeout(ctx, path, ctx->cur_bucket,
@@ -103,7 +114,7 @@ dfs_create(const char *path,
         pentry_set_usermd(pe, usermd);
         pentry_md_unlock(pe);
 
-        if (! exclude) {
+        if (! exclude && ! offline) {
                 rc = dfs_mknod_timeout(ctx, path);
                 if (DPL_SUCCESS != rc) {
                         LOG(LOG_ERR, "dfs_mknod_timeout: %s", dpl_status_str(rc));
@@ -114,6 +125,12 @@ dfs_create(const char *path,
 
         ret = 0;
   err:
+        /* opened, but the creation failed: no release will follow */
+        if (ret && pe) {
+                pentry_dec_refcount(pe);
+                info->fh = 0;
+        }
+
         if (usermd)
                 dpl_dict_free(usermd);
 
@@ -0,0 +1,225 @@
+#include <errno.h>
+#include <glib.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "delete.h"
+#include "timeout.h"
+#include "throttle.h"
+#include "log.h"
+#include "tmpstr.h"
+
+/* removals queued at most, the callers wait beyond */
+#define DELETE_MAX_PENDING 1000
+/* failed removals kept hidden at most, the callers remove beyond */
+#define DELETE_MAX_FAILED 1000
+
+extern struct conf *conf;
+extern dpl_ctx_t *ctx;
+
+static GThreadPool *delete_pool = NULL;
+
+static pthread_mutex_t delete_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t delete_cond = PTHREAD_COND_INITIALIZER;
+
+static GHashTable *pending = NULL; /* paths being removed */
+static GHashTable *failed = NULL; /* path -> status, until a flush */
+static unsigned long long done = 0;
+static unsigned long long failures = 0;
+
+/* `path' is `dir' or under it */
+static int
+delete_under(const char *path,
+             const char *dir)
+{
+        size_t len;
+
+        if (! dir)
+                return 1;
+
+        len = strlen(dir);
+        if (strncmp(path, dir, len))
+                return 0;
+
+        return ! path[len] || '/' == path[len] || '/' == dir[len - 1];
+}
+
+/* called with delete_mutex held */
+static int
+delete_any_pending(const char *dir)
+{
+        GHashTableIter iter;
+        gpointer key;
+
+        g_hash_table_iter_init(&iter, pending);
+        while (g_hash_table_iter_next(&iter, &key, NULL))
+                if (delete_under(key, dir))
+                        return 1;
+
+        return 0;
+}
+
+static void
+delete_worker(gpointer data,
+              gpointer user_data)
+{
+        char *path = data;
+        dpl_status_t rc;
+
+        (void)user_data;
+
+        throttle_set_class(THROTTLE_WRITEBACK);
+
+        rc = dfs_unlink_timeout(ctx, path);
+
+        pthread_mutex_lock(&delete_mutex);
+
+        g_hash_table_remove(pending, path);
+        done++;
+
+        /* someone else did it for us */
+        if (DPL_SUCCESS == rc || DPL_ENOENT == rc) {
+                free(path);
+        } else {
+                LOG(LOG_ERR, "%s: dfs_unlink_timeout: %s",
+                    path, dpl_status_str(rc));
+                failures++;
+                g_hash_table_replace(failed, path, GINT_TO_POINTER(rc));
+        }
+
+        pthread_cond_broadcast(&delete_cond);
+        pthread_mutex_unlock(&delete_mutex);
+}
+
+int
+delete_init(void)
+{
+        GError *err = NULL;
+
+        if (! conf->delete_threads)
+                return 0;
+
+        pending = g_hash_table_new(g_str_hash, g_str_equal);
+        failed = g_hash_table_new_full(g_str_hash, g_str_equal, free, NULL);
+
+        delete_pool = g_thread_pool_new(delete_worker, NULL,
+                                        conf->delete_threads, FALSE, &err);
+        if (err) {
+                LOG(LOG_ERR, "delete thread pool creation: %s", err->message);
+                delete_pool = NULL;
+                return -1;
+        }
+
+        return 0;
+}
+
+int
+delete_queue(const char *path)
+{
+        char *copy = NULL;
+        int ret;
+
+        if (! delete_pool)
+                return -1;
+
+        copy = strdup(path);
+        if (! copy) {
+                LOG(LOG_ERR, "%s: strdup: %s", path, strerror(errno));
+                return -1;
+        }
+
+        pthread_mutex_lock(&delete_mutex);
+
+        /* an earlier removal failed, this one is the news */
+        g_hash_table_remove(failed, path);
+
+        /* too many failures to hide, let the caller see its own */
+        if (g_hash_table_size(failed) >= DELETE_MAX_FAILED) {
+                free(copy);
+                ret = -1;
+                goto end;
+        }
+
+        if (g_hash_table_lookup(pending, path)) {
+                free(copy);
+                ret = 0;
+                goto end;
+        }
+
+        while (g_hash_table_size(pending) >= DELETE_MAX_PENDING)
+                pthread_cond_wait(&delete_cond, &delete_mutex);
+
+        g_hash_table_insert(pending, copy, copy);
+        g_thread_pool_push(delete_pool, copy, NULL);
+
+        ret = 0;
+  end:
+        pthread_mutex_unlock(&delete_mutex);
+
+        return ret;
+}
+
+int
+delete_pending(const char *path)
+{
+        int ret;
+
+        if (! delete_pool)
+                return 0;
+
+        pthread_mutex_lock(&delete_mutex);
+        ret = g_hash_table_lookup(pending, path) ||
+                g_hash_table_lookup(failed, path);
+        pthread_mutex_unlock(&delete_mutex);
+
+        return ret;
+}
+
+int
+delete_flush(const char *dir)
+{
+        GHashTableIter iter;
+        gpointer key;
+        int ret = 0;
+
+        if (! delete_pool)
+                return 0;
+
+        pthread_mutex_lock(&delete_mutex);
+
+        while (delete_any_pending(dir))
+                pthread_cond_wait(&delete_cond, &delete_mutex);
+
+        g_hash_table_iter_init(&iter, failed);
+        while (g_hash_table_iter_next(&iter, &key, NULL)) {
+                if (! delete_under(key, dir))
+                        continue;
+
+                LOG(LOG_ERR, "%s: could not be removed", (char *)key);
+                g_hash_table_iter_remove(&iter);
+                ret = -1;
+        }
+
+        pthread_mutex_unlock(&delete_mutex);
+
+        return ret;
+}
+
+char *
+delete_stats(void)
+{
+        char *stats = NULL;
+
+        if (! delete_pool)
+                return "off";
+
+        pthread_mutex_lock(&delete_mutex);
+
+        stats = tmpstr_printf("pending=%u done=%llu failed=%llu",
+                              g_hash_table_size(pending), done, failures);
+
+        pthread_mutex_unlock(&delete_mutex);
+
+        return stats;
+}
@@ -0,0 +1,28 @@
+#ifndef DELETE_H
+#define DELETE_H
+
+/* Removals sent in the background by a pool of threads, so that rm -r
+ * does not wait for each object in turn.  The entry is gone from the
+ * mount point as soon as it is queued, and stays hidden if the removal
+ * fails; the failure is reported by the next rmdir of a directory above
+ * it.  Off unless delete_threads is set. */
+
+/* start the pool, return 0 or -1 */
+int delete_init(void);
+
+/* send the removal of this object, return 0 once queued, -1 if the
+ * caller has to remove it itself (no pool, or too many failures held);
+ * wait while too many are pending */
+int delete_queue(const char *);
+
+/* 1 if the object is being removed, or its removal failed */
+int delete_pending(const char *);
+
+/* wait for the removals of this path and of what is under it (of all
+ * of them if NULL), return -1 if one of them failed, 0 otherwise */
+int delete_flush(const char *);
+
+/* the removals pending, done and failed, in a temporary string */
+char *delete_stats(void);
+
+#endif /* DELETE_H */
@@ -28,6 +28,7 @@
 
 #include "getattr.h"
 #include "setxattr.h"
+#include "getxattr.h"
 
 #include "opendir.h"
 #include "mkdir.h"
@@ -35,6 +36,8 @@
 #include "rmdir.h"
 
 #include "fsync.h"
+#include "flush.h"
+#include "truncate.h"
 #include "rename.h"
 #include "chmod.h"
 #include "chown.h"
@@ -44,6 +47,14 @@
 
 #include "cachedir.h"
 #include "gc.h"
+#include "prefetch.h"
+#include "trace.h"
+#include "pin.h"
+#include "timeout.h"
+#include "hedge.h"
+#include "endpoint.h"
+#include "breaker.h"
+#include "delete.h"
 #include "regex.h"
 #include "conf.h"
 #include "env.h"
@@ -57,16 +68,6 @@ struct conf *conf = NULL;
 
 /* Not implemented yet */
 
-static int
-dfs_getxattr(const char *path,
-             const char *name,
-             char *value,
-             size_t size)
-{
-        LOG(LOG_DEBUG, "path=%s, value=%s", path, value);
-        return 0;
-}
-
 static int
 dfs_listxattr(const char *path,
               char *list,
@@ -76,24 +77,6 @@ dfs_listxattr(const char *path,
         return 0;
 }
 
-static int
-dfs_removexattr(const char *path,
-                const char *name)
-{
-        LOG(LOG_DEBUG, "path=%s, name=%s", path, name);
-        return 0;
-}
-
-static int
-dfs_flush(const char *path,
-          struct fuse_file_info *info)
-{
-        (void)info;
-
-        LOG(LOG_DEBUG, "%s", path);
-        return 0;
-}
-
 static int
 dfs_truncate(const char *path,
              off_t offset)
@@ -118,9 +101,19 @@ static int
 dfs_releasedir(const char *path,
                struct fuse_file_info *info)
 {
-        (void) info;
+        tpath_entry *pe = (tpath_entry *)info->fh;
+
+        /* libfuse does not build the path of an open directory */
+        (void)path;
+
+        if (! pe) {
+                LOG(LOG_ERR, "no path entry");
+                return 0;
+        }
+
+        LOG(LOG_DEBUG, "%s", pe->path);
+        pentry_dec_refcount(pe);
 
-        LOG(LOG_DEBUG, "%s", path);
         return 0;
 }
 
@@ -129,17 +122,18 @@ dfs_fsyncdir(const char *path,
              int datasync,
              struct fuse_file_info *info)
 {
+        tpath_entry *pe = (tpath_entry *)info->fh;
+
+        (void)path;
         (void)datasync;
-        (void)info;
 
-        LOG(LOG_DEBUG, "%s", path);
+        LOG(LOG_DEBUG, "%s", pe ? pe->path : "(no entry)");
         return 0;
 }
 
 static void *
 dfs_init(struct fuse_conn_info *conn)
 {
-        (void)conn;
         pthread_t gc_id;
         pthread_t cachedir_id;
         pthread_attr_t gc_attr;
@@ -148,6 +142,18 @@ dfs_init(struct fuse_conn_info *conn)
 
         LOG(LOG_DEBUG, "Entering function");
 
+        /* before the threads which talk to the object store */
+        (void)endpoint_init();
+
+        /* read_buf/write_buf work on the cache file descriptors, let the
+         * kernel splice the data from and to /dev/fuse */
+        conn->want |= conn->capable & (FUSE_CAP_SPLICE_READ |
+                                       FUSE_CAP_SPLICE_WRITE |
+                                       FUSE_CAP_SPLICE_MOVE);
+
+        LOG(LOG_INFO, "fuse capabilities=0x%x, wanted=0x%x",
+            conn->capable, conn->want);
+
         pthread_attr_init(&gc_attr);
         pthread_attr_setdetachstate(&gc_attr, PTHREAD_CREATE_JOINABLE);
         pthread_create(&gc_id, &gc_attr, thread_gc, hash);
@@ -156,6 +162,25 @@ dfs_init(struct fuse_conn_info *conn)
         pthread_attr_setdetachstate(&cachedir_attr, PTHREAD_CREATE_JOINABLE);
         pthread_create(&cachedir_id, &cachedir_attr, thread_cachedir, hash);
 
+        if (-1 == hedge_init())
+                LOG(LOG_ERR, "requests will not be hedged");
+
+        if (-1 == breaker_init())
+                LOG(LOG_ERR, "no offline mode");
+
+        if (-1 == delete_init())
+                LOG(LOG_ERR, "removals will be sent one at a time");
+
+        if (-1 == rename_init())
+                LOG(LOG_ERR, "directories will be renamed one file at a time");
+
+        /* warm start: fetch again what was used before the last unmount */
+        if (0 == prefetch_init()) {
+                if (0 == trace_load())
+                        trace_replay();
+                (void)pin_load();
+        }
+
         return NULL;
 }
 
@@ -169,6 +194,12 @@ cb_hash_unlink(gpointer key,
         tpath_entry *pe = value;
 
         if (pe) {
+                /* never uploaded, the only copy */
+                if (FLAG_DIRTY == pe->flag) {
+                        LOG(LOG_ERR, "keep cache file '%s'", pe->path);
+                        return;
+                }
+
                 if (FILE_LOCAL == pe->ondisk) {
                         LOG(LOG_INFO, "remove cache file '%s'", pe->path);
                         pentry_unlink_cache_file(pe);
@@ -181,6 +212,13 @@ dfs_destroy(void *arg)
 {
         LOG(LOG_DEBUG, "%p", arg);
 
+        /* before the retries are cut short */
+        (void)delete_flush(NULL);
+        dfs_retry_shutdown();
+        breaker_stop();
+        prefetch_stop();
+        (void)trace_save();
+
         if (hash) {
                 LOG(LOG_DEBUG, "removing cache files");
                 g_hash_table_foreach(hash, cb_hash_unlink, NULL);
@@ -217,29 +255,19 @@ dfs_access(const char *path, int perm)
         return 0;
 }
 
-static int
-dfs_ftruncate(const char *path,
-              off_t offset,
-              struct fuse_file_info *info)
-{
-        (void)offset;
-        (void)info;
-
-        LOG(LOG_DEBUG, "%s", path);
-        return 0;
-}
-
 static int
 dfs_lock(const char *path,
          struct fuse_file_info *info,
          int cmd,
          struct flock *flock)
 {
-        (void)info;
+        tpath_entry *pe = (tpath_entry *)info->fh;
+
+        (void)path;
         (void)cmd;
         (void)flock;
 
-        LOG(LOG_DEBUG, "%s", path);
+        LOG(LOG_DEBUG, "%s", pe ? pe->path : "(no entry)");
         return 0;
 }
 
@@ -299,16 +327,20 @@ struct fuse_operations dfs_ops = {
         .getattr    = dfs_getattr,
         .mkdir      = dfs_mkdir,
         .write      = dfs_write,
+        .write_buf  = dfs_write_buf,
         .readdir    = dfs_readdir,
         .opendir    = dfs_opendir,
         .unlink     = dfs_unlink,
         .rmdir      = dfs_rmdir,
         .statfs     = dfs_statfs,
         .read       = dfs_read,
+        .read_buf   = dfs_read_buf,
         .release    = dfs_release,
         .open       = dfs_open,
         .fsync      = dfs_fsync,
         .setxattr   = dfs_setxattr,
+        .getxattr   = dfs_getxattr,
+        .removexattr= dfs_removexattr,
         .create     = dfs_create,
         .chmod      = dfs_chmod,
         .chown      = dfs_chown,
@@ -316,20 +348,23 @@ struct fuse_operations dfs_ops = {
         .readlink   = dfs_readlink,
         .symlink    = dfs_symlink,
         .rename     = dfs_rename,
+        .fgetattr   = dfs_fgetattr,
+        .ftruncate  = dfs_ftruncate,
+        .flush      = dfs_flush,
+
+        /* per-file ops work on info->fh, no need to build paths */
+        .flag_nullpath_ok = 1,
+        .flag_nopath      = 1,
 
         /* not implemented yet */
-        .getxattr   = dfs_getxattr,
         .listxattr  = dfs_listxattr,
-        .removexattr= dfs_removexattr,
         .truncate   = dfs_truncate,
         .utime      = dfs_utime,
-        .flush      = dfs_flush,
         .fsyncdir   = dfs_fsyncdir,
         .init       = dfs_init,
         .destroy    = dfs_destroy,
         .access     = dfs_access,
         .releasedir = dfs_releasedir,
-        .ftruncate  = dfs_ftruncate,
         .lock       = dfs_lock,
         .utimens    = dfs_utimens,
         .bmap       = dfs_bmap,
@@ -345,9 +380,43 @@ struct fuse_operations dfs_ops = {
 static int
 dfs_fuse_main(struct fuse_args *args)
 {
+        /* args->argv is main()'s argv, libfuse can't grow it: work on a
+         * copy that fuse_opt_add_arg() allocates and may realloc */
+        struct fuse_args own = FUSE_ARGS_INIT(0, NULL);
+        char *opts = NULL;
+        int ret = -1;
+        int i;
+
         hash = g_hash_table_new_full(g_str_hash, g_str_equal,
                                      free, (GDestroyNotify)pentry_free);
-        return fuse_main(args->argc, args->argv, &dfs_ops, NULL);
+
+        for (i = 0; i < args->argc; i++) {
+                if (-1 == fuse_opt_add_arg(&own, args->argv[i])) {
+                        LOG(LOG_ERR, "can't copy argument '%s'",
+                            args->argv[i]);
+                        goto end;
+                }
+
+                if (i)
+                        continue;
+
+                /* every getattr/lookup answered by the kernel caches, and
+                 * every 128k write instead of 4k pages, is a request less on
+                 * /dev/fuse.  Given before the command line, whose own -o
+                 * options come later and win */
+                opts = tmpstr_printf("-oattr_timeout=%d,entry_timeout=%d,"
+                                     "big_writes", conf->attr_timeout,
+                                     conf->entry_timeout);
+                if (-1 == fuse_opt_add_arg(&own, opts))
+                        LOG(LOG_ERR, "can't add the mount options '%s'", opts);
+        }
+
+        ret = fuse_main(own.argc, own.argv, &dfs_ops, NULL);
+
+  end:
+        fuse_opt_free_args(&own);
+
+        return ret;
 }
 
 
@@ -399,14 +468,37 @@ conf_log(struct conf *conf)
 {
         LOG(LOG_ERR, "zlib level: %d", conf->zlib_level);
         LOG(LOG_ERR, "encryption method: %s", conf->encryption_method);
+        LOG(LOG_ERR, "cache layout: %s", conf->cache_layout);
         LOG(LOG_ERR, "compression method: %s", conf->compression_method);
         LOG(LOG_ERR, "local cache directory: %s", conf->cache_dir);
         LOG(LOG_ERR, "max number I/O attempts: %d", conf->max_retry);
+        LOG(LOG_ERR, "retry deadline: %d", conf->retry_deadline);
+        LOG(LOG_ERR, "retry data deadline: %d", conf->retry_data_deadline);
         LOG(LOG_ERR, "gc loop delay: %d", conf->gc_loop_delay);
         LOG(LOG_ERR, "gc age threshold: %d", conf->gc_age_threshold);
         LOG(LOG_ERR, "sc loop delay: %d", conf->sc_loop_delay);
         LOG(LOG_ERR, "sc age threshold: %d", conf->sc_age_threshold);
         LOG(LOG_ERR, "cache max size: %d", conf->cache_max_size);
+        LOG(LOG_ERR, "disk cache size: %llu", conf->disk_cache_size);
+        LOG(LOG_ERR, "disk cache min free: %d%%", conf->disk_cache_min_free);
+        LOG(LOG_ERR, "max open files: %d", conf->max_open_files);
+        LOG(LOG_ERR, "sparse cache min size: %llu",
+            conf->sparse_cache_min_size);
+        LOG(LOG_ERR, "ram cache size: %llu", conf->ram_cache_size);
+        LOG(LOG_ERR, "ram cache max file: %d", conf->ram_cache_max_file);
+        LOG(LOG_ERR, "trace max files: %d", conf->trace_max_files);
+        LOG(LOG_ERR, "prefetch threads: %d", conf->prefetch_threads);
+        LOG(LOG_ERR, "delete threads: %d", conf->delete_threads);
+        LOG(LOG_ERR, "rename threads: %d", conf->rename_threads);
+        LOG(LOG_ERR, "hedge percentile: %d", conf->hedge_percentile);
+        LOG(LOG_ERR, "hedge budget: %d%%", conf->hedge_budget);
+        LOG(LOG_ERR, "max inflight: %d", conf->max_inflight);
+        LOG(LOG_ERR, "endpoints: %s",
+            conf->endpoints ? conf->endpoints : "from the profile");
+        LOG(LOG_ERR, "offline failures: %d", conf->offline_failures);
+        LOG(LOG_ERR, "offline probe delay: %d", conf->offline_probe_delay);
+        LOG(LOG_ERR, "attr timeout: %d", conf->attr_timeout);
+        LOG(LOG_ERR, "entry timeout: %d", conf->entry_timeout);
         LOG(LOG_ERR, "debug level: %d (%s)",
             conf->log_level, log_level_to_str(conf->log_level));
         LOG(LOG_ERR, "exclusion regex: '%s'", conf->regex.str);
@@ -0,0 +1,396 @@
+#include <errno.h>
+#include <glib.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "endpoint.h"
+#include "breaker.h"
+#include "log.h"
+#include "tmpstr.h"
+
+/* failures in a row before an endpoint is left aside */
+#define ENDPOINT_MAX_FAILURES 3
+/* how long it is left aside the first time, then twice longer each time,
+ * in seconds */
+#define ENDPOINT_EJECT_MIN 5
+#define ENDPOINT_EJECT_MAX 60
+/* the probe thread period, in seconds */
+#define ENDPOINT_PROBE_DELAY 1
+
+extern struct conf *conf;
+extern dpl_ctx_t *ctx;
+
+struct endpoint {
+        dpl_ctx_t *ctx;
+        char *name; /* host:port */
+        double avg_ms;
+        int inflight;
+        int failures; /* in a row */
+        int eject_delay; /* in seconds, of the next ejection */
+        time_t ejected_until; /* 0 if the endpoint is up */
+        unsigned long long requests;
+        unsigned long long ejections;
+};
+
+/* the context of the droplet profile, if no endpoints are set */
+static struct endpoint profile;
+/* the endpoints set in the configuration */
+static struct endpoint *list = NULL;
+
+static struct endpoint *endpoints = &profile;
+static int n_endpoints = 1;
+static pthread_mutex_t endpoint_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int
+endpoint_up(struct endpoint *ep)
+{
+        return ! ep->ejected_until;
+}
+
+/* the expected wait on this endpoint, the lower the better */
+static double
+endpoint_score(struct endpoint *ep)
+{
+        return (ep->avg_ms > 0 ? ep->avg_ms : 1) * (ep->inflight + 1);
+}
+
+/* called with endpoint_mutex held */
+static void
+endpoint_eject(struct endpoint *ep)
+{
+        ep->ejected_until = time(NULL) + ep->eject_delay;
+        ep->ejections++;
+
+        LOG(LOG_ERR, "%s: %d failures in a row, ejected for %ds",
+            ep->name, ep->failures, ep->eject_delay);
+
+        ep->eject_delay *= 2;
+        if (ep->eject_delay > ENDPOINT_EJECT_MAX)
+                ep->eject_delay = ENDPOINT_EJECT_MAX;
+}
+
+/* called with endpoint_mutex held */
+static void
+endpoint_admit(struct endpoint *ep)
+{
+        if (! endpoint_up(ep))
+                LOG(LOG_NOTICE, "%s: back", ep->name);
+
+        ep->ejected_until = 0;
+        ep->failures = 0;
+        ep->eject_delay = ENDPOINT_EJECT_MIN;
+}
+
+/* an answer, even a negative one, shows the endpoint is alive */
+static int
+endpoint_failed(dpl_status_t rc)
+{
+        switch (rc) {
+        case DPL_FAILURE:
+        case DPL_ETIMEOUT:
+        case DPL_EIO:
+                return 1;
+        default:
+                return 0;
+        }
+}
+
+/* Two endpoints drawn at random, the one with the lowest score wins: the
+ * load follows the latencies without all going to the quickest one. */
+struct endpoint *
+endpoint_get(void)
+{
+        struct endpoint *a = NULL;
+        struct endpoint *b = NULL;
+        struct endpoint *ep = NULL;
+        int i;
+
+        if (1 == n_endpoints)
+                return endpoints;
+
+        pthread_mutex_lock(&endpoint_mutex);
+
+        a = &endpoints[g_random_int_range(0, n_endpoints)];
+        b = &endpoints[g_random_int_range(0, n_endpoints)];
+
+        if (! endpoint_up(a))
+                a = NULL;
+        if (! endpoint_up(b))
+                b = NULL;
+
+        /* unlucky draw, take the first one up */
+        for (i = 0; ! a && ! b && i < n_endpoints; i++)
+                if (endpoint_up(&endpoints[i]))
+                        a = &endpoints[i];
+
+        if (a && b)
+                ep = endpoint_score(a) <= endpoint_score(b) ? a : b;
+        else if (a || b)
+                ep = a ? a : b;
+
+        /* all ejected: the one which should be back first */
+        if (! ep) {
+                ep = &endpoints[0];
+                for (i = 1; i < n_endpoints; i++)
+                        if (endpoints[i].ejected_until < ep->ejected_until)
+                                ep = &endpoints[i];
+        }
+
+        ep->inflight++;
+        ep->requests++;
+
+        pthread_mutex_unlock(&endpoint_mutex);
+
+        return ep;
+}
+
+dpl_ctx_t *
+endpoint_ctx(struct endpoint *ep)
+{
+        return ep->ctx;
+}
+
+void
+endpoint_put(struct endpoint *ep,
+             dpl_status_t rc,
+             struct timespec *start)
+{
+        struct timespec now;
+        int ms;
+
+        /* the store as a whole, whatever the endpoint */
+        breaker_record(rc);
+
+        if (1 == n_endpoints)
+                return;
+
+        pthread_mutex_lock(&endpoint_mutex);
+
+        ep->inflight--;
+
+        if (endpoint_failed(rc)) {
+                ep->failures++;
+                if (endpoint_up(ep) && ep->failures >= ENDPOINT_MAX_FAILURES)
+                        endpoint_eject(ep);
+        } else {
+                ep->failures = 0;
+                if (start) {
+                        clock_gettime(CLOCK_MONOTONIC, &now);
+                        ms = (now.tv_sec - start->tv_sec) * 1000 +
+                                (now.tv_nsec - start->tv_nsec) / 1000000;
+                        ep->avg_ms = ep->avg_ms > 0 ?
+                                ep->avg_ms + (ms - ep->avg_ms) / 8 : ms;
+                }
+        }
+
+        pthread_mutex_unlock(&endpoint_mutex);
+}
+
+int
+endpoint_failover(void)
+{
+        int up = 0;
+        int i;
+
+        if (1 == n_endpoints)
+                return 0;
+
+        pthread_mutex_lock(&endpoint_mutex);
+
+        for (i = 0; i < n_endpoints; i++)
+                if (endpoint_up(&endpoints[i]))
+                        up++;
+
+        pthread_mutex_unlock(&endpoint_mutex);
+
+        return up > 1;
+}
+
+/* called by the probe thread only */
+static int
+endpoint_alive(struct endpoint *ep)
+{
+        dpl_dict_t *metadata = NULL;
+        dpl_status_t rc;
+
+        rc = dpl_getattr(ep->ctx, "/", &metadata);
+        if (metadata)
+                dpl_dict_free(metadata);
+
+        LOG(LOG_DEBUG, "%s: probe: %s", ep->name, dpl_status_str(rc));
+
+        return ! endpoint_failed(rc);
+}
+
+/* the ejected endpoints are asked the root directory when their time is
+ * over, and used again if they answer */
+static void *
+thread_probe(void *arg)
+{
+        struct endpoint *ep = NULL;
+        time_t now;
+        int due;
+        int i;
+
+        (void)arg;
+
+        for (;;) {
+                sleep(ENDPOINT_PROBE_DELAY);
+
+                for (i = 0; i < n_endpoints; i++) {
+                        ep = &endpoints[i];
+                        now = time(NULL);
+
+                        pthread_mutex_lock(&endpoint_mutex);
+                        due = ! endpoint_up(ep) && ep->ejected_until <= now;
+                        pthread_mutex_unlock(&endpoint_mutex);
+
+                        if (! due)
+                                continue;
+
+                        if (endpoint_alive(ep)) {
+                                pthread_mutex_lock(&endpoint_mutex);
+                                endpoint_admit(ep);
+                                pthread_mutex_unlock(&endpoint_mutex);
+                        } else {
+                                pthread_mutex_lock(&endpoint_mutex);
+                                endpoint_eject(ep);
+                                pthread_mutex_unlock(&endpoint_mutex);
+                        }
+                }
+        }
+
+        return NULL;
+}
+
+/* "host:port", or "host" for the port of the profile */
+static int
+endpoint_ctor(struct endpoint *ep,
+              const char *name)
+{
+        char *colon = NULL;
+
+        ep->ctx = dpl_ctx_new(NULL, NULL);
+        if (! ep->ctx) {
+                LOG(LOG_ERR, "%s: dpl_ctx_new failed", name);
+                return -1;
+        }
+
+        ep->ctx->trace_level = ctx->trace_level;
+        ep->ctx->cur_bucket = strdup(ctx->cur_bucket);
+        ep->name = strdup(name);
+        free(ep->ctx->host);
+        ep->ctx->host = strdup(name);
+        if (! ep->ctx->cur_bucket || ! ep->name || ! ep->ctx->host) {
+                LOG(LOG_ERR, "strdup: %s", strerror(errno));
+                return -1;
+        }
+
+        colon = strrchr(ep->ctx->host, ':');
+        if (colon) {
+                *colon = 0;
+                ep->ctx->port = atoi(colon + 1);
+        }
+
+        ep->eject_delay = ENDPOINT_EJECT_MIN;
+
+        LOG(LOG_INFO, "endpoint %s, host=%s port=%d",
+            ep->name, ep->ctx->host, ep->ctx->port);
+
+        return 0;
+}
+
+int
+endpoint_init(void)
+{
+        char **names = NULL;
+        pthread_t id;
+        pthread_attr_t attr;
+        int n;
+        int i;
+        int ret;
+
+        /* until told otherwise, the context of the profile */
+        profile.ctx = ctx;
+        profile.name = ctx->host;
+        endpoints = &profile;
+        n_endpoints = 1;
+
+        if (! conf->endpoints || ! *conf->endpoints)
+                return 0;
+
+        names = g_strsplit(conf->endpoints, ",", -1);
+        n = g_strv_length(names);
+
+        list = calloc(n, sizeof *list);
+        if (! list) {
+                LOG(LOG_ERR, "calloc: %s", strerror(errno));
+                ret = -1;
+                goto err;
+        }
+
+        for (i = 0; i < n; i++) {
+                g_strstrip(names[i]);
+                if (-1 == endpoint_ctor(&list[i], names[i])) {
+                        ret = -1;
+                        goto err;
+                }
+        }
+
+        endpoints = list;
+        n_endpoints = n;
+
+        if (n > 1) {
+                pthread_attr_init(&attr);
+                pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+                ret = pthread_create(&id, &attr, thread_probe, NULL);
+                pthread_attr_destroy(&attr);
+                if (ret)
+                        /* they are ejected for good, the others do the job */
+                        LOG(LOG_ERR, "pthread_create: %s", strerror(ret));
+        }
+
+        ret = 0;
+  err:
+        g_strfreev(names);
+
+        if (ret) {
+                LOG(LOG_ERR, "bad endpoints '%s', using the profile",
+                    conf->endpoints);
+                for (i = 0; list && i < n; i++) {
+                        if (list[i].ctx)
+                                dpl_ctx_free(list[i].ctx);
+                        free(list[i].name);
+                }
+                free(list);
+                list = NULL;
+        }
+
+        return ret;
+}
+
+char *
+endpoint_stats(void)
+{
+        struct endpoint *ep = NULL;
+        char *stats = "";
+        int i;
+
+        pthread_mutex_lock(&endpoint_mutex);
+
+        for (i = 0; i < n_endpoints; i++) {
+                ep = &endpoints[i];
+                stats = tmpstr_printf("%s%s%s %s avg_ms=%d inflight=%d "
+                                      "requests=%llu ejections=%llu",
+                                      stats, i ? "; " : "", ep->name,
+                                      endpoint_up(ep) ? "up" : "ejected",
+                                      (int)ep->avg_ms, ep->inflight,
+                                      ep->requests, ep->ejections);
+        }
+
+        pthread_mutex_unlock(&endpoint_mutex);
+
+        return stats;
+}
@@ -0,0 +1,29 @@
+#ifndef ENDPOINT_H
+#define ENDPOINT_H
+
+#include <time.h>
+#include <droplet.h>
+
+/* The storage connectors a request can go to, one droplet context each.
+ * Without the endpoints setting, there is only the context of the
+ * droplet profile. */
+struct endpoint;
+
+/* after the configuration is read, and a probe thread for the ejected
+ * endpoints; return 0 or -1 */
+int endpoint_init(void);
+
+/* the endpoint for a new request, most likely the quickest one */
+struct endpoint *endpoint_get(void);
+dpl_ctx_t *endpoint_ctx(struct endpoint *);
+/* the answer of the request, and when it was sent if its latency means
+ * something (NULL for transfers); the breaker sees it too */
+void endpoint_put(struct endpoint *, dpl_status_t, struct timespec *);
+
+/* a failed request can be sent again at once, to another endpoint */
+int endpoint_failover(void);
+
+/* their state, in a temporary string */
+char *endpoint_stats(void);
+
+#endif /* ENDPOINT_H */
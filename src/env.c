@@ -41,6 +41,31 @@ env_generic_set_int(int *var,
         return ret;
 }
 
+static int
+env_generic_set_ull(unsigned long long *var,
+                    const char * const id)
+{
+        char *tmp = NULL;
+        int ret;
+
+        if (! var) {
+                ret = -1;
+                goto end;
+        }
+
+        tmp = getenv(id);
+        if (! tmp || ! *tmp) {
+                ret = -1;
+                goto end;
+        }
+
+        *var = strtoull(tmp, NULL, 10);
+
+        ret = 0;
+  end:
+        return ret;
+}
+
 static int
 env_generic_set_str(char **var,
                     const char * const id)
@@ -130,6 +155,139 @@ env_set_cache_max_size(struct conf *conf)
                                   "DROPLETFS_CACHE_MAX_SIZE");
 }
 
+static void
+env_set_disk_cache_size(struct conf *conf)
+{
+        (void)env_generic_set_ull(&conf->disk_cache_size,
+                                  "DROPLETFS_DISK_CACHE_SIZE");
+}
+
+static void
+env_set_disk_cache_min_free(struct conf *conf)
+{
+        (void)env_generic_set_int(&conf->disk_cache_min_free,
+                                  "DROPLETFS_DISK_CACHE_MIN_FREE");
+}
+
+static void
+env_set_trace_max_files(struct conf *conf)
+{
+        (void)env_generic_set_int(&conf->trace_max_files,
+                                  "DROPLETFS_TRACE_MAX_FILES");
+}
+
+static void
+env_set_retry_deadline(struct conf *conf)
+{
+        (void)env_generic_set_int(&conf->retry_deadline,
+                                  "DROPLETFS_RETRY_DEADLINE");
+}
+
+static void
+env_set_retry_data_deadline(struct conf *conf)
+{
+        (void)env_generic_set_int(&conf->retry_data_deadline,
+                                  "DROPLETFS_RETRY_DATA_DEADLINE");
+}
+
+static void
+env_set_prefetch_threads(struct conf *conf)
+{
+        (void)env_generic_set_int(&conf->prefetch_threads,
+                                  "DROPLETFS_PREFETCH_THREADS");
+}
+
+static void
+env_set_delete_threads(struct conf *conf)
+{
+        (void)env_generic_set_int(&conf->delete_threads,
+                                  "DROPLETFS_DELETE_THREADS");
+}
+
+static void
+env_set_rename_threads(struct conf *conf)
+{
+        (void)env_generic_set_int(&conf->rename_threads,
+                                  "DROPLETFS_RENAME_THREADS");
+}
+
+static void
+env_set_hedge_percentile(struct conf *conf)
+{
+        (void)env_generic_set_int(&conf->hedge_percentile,
+                                  "DROPLETFS_HEDGE_PERCENTILE");
+}
+
+static void
+env_set_hedge_budget(struct conf *conf)
+{
+        (void)env_generic_set_int(&conf->hedge_budget,
+                                  "DROPLETFS_HEDGE_BUDGET");
+}
+
+static void
+env_set_max_inflight(struct conf *conf)
+{
+        (void)env_generic_set_int(&conf->max_inflight,
+                                  "DROPLETFS_MAX_INFLIGHT");
+}
+
+static void
+env_set_offline_failures(struct conf *conf)
+{
+        (void)env_generic_set_int(&conf->offline_failures,
+                                  "DROPLETFS_OFFLINE_FAILURES");
+}
+
+static void
+env_set_offline_probe_delay(struct conf *conf)
+{
+        (void)env_generic_set_int(&conf->offline_probe_delay,
+                                  "DROPLETFS_OFFLINE_PROBE_DELAY");
+}
+
+static void
+env_set_ram_cache_size(struct conf *conf)
+{
+        (void)env_generic_set_ull(&conf->ram_cache_size,
+                                  "DROPLETFS_RAM_CACHE_SIZE");
+}
+
+static void
+env_set_ram_cache_max_file(struct conf *conf)
+{
+        (void)env_generic_set_int(&conf->ram_cache_max_file,
+                                  "DROPLETFS_RAM_CACHE_MAX_FILE");
+}
+
+static void
+env_set_sparse_cache_min_size(struct conf *conf)
+{
+        (void)env_generic_set_ull(&conf->sparse_cache_min_size,
+                                  "DROPLETFS_SPARSE_CACHE_MIN_SIZE");
+}
+
+static void
+env_set_max_open_files(struct conf *conf)
+{
+        (void)env_generic_set_int(&conf->max_open_files,
+                                  "DROPLETFS_MAX_OPEN_FILES");
+}
+
+static void
+env_set_attr_timeout(struct conf *conf)
+{
+        (void)env_generic_set_int(&conf->attr_timeout,
+                                  "DROPLETFS_ATTR_TIMEOUT");
+}
+
+static void
+env_set_entry_timeout(struct conf *conf)
+{
+        (void)env_generic_set_int(&conf->entry_timeout,
+                                  "DROPLETFS_ENTRY_TIMEOUT");
+}
+
 static void
 env_set_log_level(struct conf *conf)
 {
@@ -155,6 +313,20 @@ env_set_exclusion_pattern(struct conf *conf)
         (void)re_ctor(&conf->regex, tmp, REG_EXTENDED);
 }
 
+static void
+env_set_cache_layout(struct conf *conf)
+{
+        (void)env_generic_set_str(&conf->cache_layout,
+                                  "DROPLETFS_CACHE_LAYOUT");
+}
+
+static void
+env_set_endpoints(struct conf *conf)
+{
+        (void)env_generic_set_str(&conf->endpoints,
+                                  "DROPLETFS_ENDPOINTS");
+}
+
 static void
 env_set_encryption_method(struct conf *conf)
 {
@@ -168,12 +340,33 @@ env_override_conf(struct conf *conf)
         env_set_compression_method(conf);
         env_set_compression_level(conf);
         env_set_max_retry(conf);
+        env_set_retry_deadline(conf);
+        env_set_retry_data_deadline(conf);
         env_set_gc_loop_delay(conf);
         env_set_gc_age_threshold(conf);
         env_set_sc_loop_delay(conf);
         env_set_sc_age_threshold(conf);
         env_set_exclusion_pattern(conf);
         env_set_cache_max_size(conf);
+        env_set_disk_cache_size(conf);
+        env_set_disk_cache_min_free(conf);
+        env_set_max_open_files(conf);
+        env_set_sparse_cache_min_size(conf);
+        env_set_ram_cache_size(conf);
+        env_set_ram_cache_max_file(conf);
+        env_set_trace_max_files(conf);
+        env_set_prefetch_threads(conf);
+        env_set_delete_threads(conf);
+        env_set_rename_threads(conf);
+        env_set_hedge_percentile(conf);
+        env_set_hedge_budget(conf);
+        env_set_max_inflight(conf);
+        env_set_offline_failures(conf);
+        env_set_offline_probe_delay(conf);
+        env_set_attr_timeout(conf);
+        env_set_entry_timeout(conf);
         env_set_log_level(conf);
         env_set_encryption_method(conf);
+        env_set_cache_layout(conf);
+        env_set_endpoints(conf);
 }
@@ -3,6 +3,7 @@
 #include <libgen.h>
 #include <unistd.h>
 #include <errno.h>
+#include <limits.h>
 
 #include "log.h"
 #include "file.h"
@@ -11,6 +12,12 @@
 #include "zip.h"
 #include "timeout.h"
 #include "utils.h"
+#include "lru.h"
+#include "block.h"
+#include "ram.h"
+#include "local.h"
+#include "throttle.h"
+#include "endpoint.h"
 
 #define WRITE_BLOCK_SIZE (1000*1000)
 
@@ -99,9 +106,12 @@ write_all(int fd,
 	}
 }
 
+/* *rcp is the status of the store, DPL_SUCCESS if only the cache file
+ * could not be read */
 int
 read_write_all_vfile(int fd,
-                     dpl_vfile_t *vfile)
+                     dpl_vfile_t *vfile,
+                     dpl_status_t *rcp)
 {
         dpl_status_t rc = DPL_FAILURE;
         int blksize = WRITE_BLOCK_SIZE;
@@ -109,6 +119,7 @@ read_write_all_vfile(int fd,
 
         LOG(LOG_DEBUG, "fd=%d", fd);
         buf = alloca(blksize);
+        *rcp = DPL_SUCCESS;
         while (1) {
                 int r = read(fd, buf, blksize);
                 if (-1 == r) {
@@ -124,6 +135,7 @@ read_write_all_vfile(int fd,
                 if (DPL_SUCCESS != rc) {
                         LOG(LOG_ERR, "dpl_write: %s (%d)",
                             dpl_status_str(rc), rc);
+                        *rcp = rc;
                         return -1;
                 }
         }
@@ -141,10 +153,18 @@ cb_get_buffered(void *arg,
 
         get_data = arg;
 
+        /* nobody will read it, stop the transfer */
+        if (dfs_interrupted()) {
+                get_data->error = EINTR;
+                return -1;
+        }
+
         ret = write_all(get_data->fd, buf, len);
 
-        if (DPL_SUCCESS != ret)
+        if (DPL_SUCCESS != ret) {
+                get_data->error = errno;
                 return -1;
+        }
 
         return 0;
 }
@@ -193,6 +213,26 @@ download_headers(char * path,
         return ret;
 }
 
+/* the download did not complete: remove what was written, so that the
+ * next open neither takes the partial file for the object nor finds its
+ * digest */
+static void
+download_rollback(tpath_entry *pe,
+                  const char *local)
+{
+        LOG(LOG_INFO, "removing partial cache file '%s'", local);
+        if (-1 == unlink(local) && ENOENT != errno)
+                LOG(LOG_ERR, "unlink(%s): %s", local, strerror(errno));
+
+        memset(pe->digest, 0, sizeof pe->digest);
+        lru_set_fd(pe, -1);
+        lru_remove(pe);
+
+        pentry_md_lock(pe);
+        pe->ondisk = pe->usermd ? FILE_REMOTE : FILE_UNSET;
+        pentry_md_unlock(pe);
+}
+
 static int
 compare_digests(tpath_entry *pe,
                 dpl_dict_t *dict)
@@ -361,6 +401,151 @@ check_encryption_flag(dpl_dict_t *metadata)
         return ret;
 }
 
+static unsigned long long
+object_size(dpl_dict_t *headers)
+{
+        char *length = NULL;
+
+        length = dpl_dict_get_value(headers, "content-length");
+        if (! length)
+                return 0;
+
+        return strtoull(length, NULL, 10);
+}
+
+/* only plain objects can be read by ranges */
+static int
+can_stream(dpl_dict_t *metadata,
+           off_t size)
+{
+        char *compressed = NULL;
+
+        /* the range requests of libdroplet take int offsets */
+        if (size > INT_MAX)
+                return 0;
+
+        compressed = dpl_dict_get_value(metadata, "compression");
+        if (compressed && strncmp(compressed, "none", strlen("none")))
+                return 0;
+
+        if (check_encryption_flag(metadata))
+                return 0;
+
+        return 1;
+}
+
+/* big enough to be cached by blocks, and readable by ranges */
+static int
+sparse_candidate(dpl_dict_t *metadata,
+                 off_t size)
+{
+        if (! conf->sparse_cache_min_size)
+                return 0;
+
+        if (size < conf->sparse_cache_min_size)
+                return 0;
+
+        return can_stream(metadata, size);
+}
+
+/* create an empty cache file of the right size, the blocks will be fetched
+ * on the first reads */
+static int
+open_sparse(tpath_entry *pe,
+            char *local,
+            off_t size,
+            mode_t mode)
+{
+        int fd;
+
+        pe->blocks = block_map_new(size);
+        if (! pe->blocks)
+                goto err;
+
+        fd = open(local, O_RDWR|O_CREAT|O_TRUNC, mode);
+        if (-1 == fd) {
+                LOG(LOG_ERR, "open(%s): %s", local, strerror(errno));
+                goto err;
+        }
+
+        /* open() applies the umask */
+        if (-1 == fchmod(fd, mode)) {
+                LOG(LOG_ERR, "fchmod(%s): %s", local, strerror(errno));
+                (void)safe_close(fd);
+                goto err;
+        }
+
+        if (-1 == ftruncate(fd, size)) {
+                LOG(LOG_ERR, "ftruncate(%s, %lld): %s",
+                    local, (long long)size, strerror(errno));
+                (void)safe_close(fd);
+                goto err;
+        }
+
+        LOG(LOG_INFO, "%s: sparse cache file, %zu blocks",
+            local, pe->blocks->nblocks);
+
+        pe->keep_cache = 0;
+        pe->transient = 0;
+
+        return fd;
+  err:
+        block_map_free(pe->blocks);
+        pe->blocks = NULL;
+        return -1;
+}
+
+int
+dfs_read_remote(tpath_entry *pe,
+                char *buf,
+                size_t size,
+                off_t offset)
+{
+        dpl_status_t rc;
+        char *data = NULL;
+        char *size_str = NULL;
+        unsigned int len = 0;
+        off_t filesize = 0;
+        int ret;
+
+        pentry_md_lock(pe);
+        if (pe->usermd)
+                size_str = dpl_dict_get_value(pe->usermd, "size");
+        if (size_str)
+                filesize = strtoull(size_str, NULL, 10);
+        pentry_md_unlock(pe);
+
+        if (offset >= filesize) {
+                ret = 0;
+                goto end;
+        }
+
+        if (offset + size > filesize)
+                size = filesize - offset;
+
+        rc = dfs_openread_range_timeout(ctx, pe->path, offset,
+                                        offset + size - 1, &data, &len);
+        if (DPL_SUCCESS != rc) {
+                LOG(LOG_ERR, "%s: dfs_openread_range_timeout: %s",
+                    pe->path, dpl_status_str(rc));
+                ret = DFS_EINTR == rc ? -EINTR : -EIO;
+                goto end;
+        }
+
+        if (len > size)
+                len = size;
+
+        memcpy(buf, data, len);
+        ret = len;
+  end:
+        if (data)
+                free(data);
+
+        LOG(LOG_DEBUG, "%s: offset=%lld, ret=%d",
+            pe->path, (long long)offset, ret);
+        return ret;
+}
+
 /* return the fd of a local copy, to operate on */
 int
 dfs_get_local_copy(tpath_entry *pe,
@@ -376,8 +561,24 @@ dfs_get_local_copy(tpath_entry *pe,
         unsigned encryption = 0;
         mode_t mode = 0644;
         char *mode_str = NULL;
+        int reclaimed = 0;
+        struct throttle throttle;
+        struct endpoint *ep = NULL;
+
+        /* called with the entry locked: other handles may be reading the
+         * remote object, leave them in stream mode */
+        if (pentry_get_refcount(pe) <= 1)
+                pe->stream = 0;
+
+        /* a copy: evictions of lru_reclaim() and lru_admit() go through
+         * the tmpstr ring too */
+        local = strdup(local_path(remote));
+        if (! local) {
+                LOG(LOG_ERR, "%s: strdup: %s", remote, strerror(errno));
+                fd = -1;
+                goto end;
+        }
 
-        local = tmpstr_printf("%s%s", conf->cache_dir, remote);
         LOG(LOG_DEBUG, "bucket=%s, path=%s, local=%s",
             ctx->cur_bucket, remote, local);
 
@@ -424,6 +625,13 @@ dfs_get_local_copy(tpath_entry *pe,
          */
         if (0 == compare_digests(pe, headers))  {
                 fd = pe->fd;
+                /* its descriptor may have been closed meanwhile */
+                if (-1 == fd) {
+                        fd = open(local, pe->blocks ? O_RDWR : flags);
+                        if (-1 == fd)
+                                LOG(LOG_ERR, "open(%s): %s",
+                                    local, strerror(errno));
+                }
                 goto end;
         }
 
@@ -435,6 +643,29 @@ dfs_get_local_copy(tpath_entry *pe,
                         LOG(LOG_ERR, "unlink(%s): %s", local, strerror(errno));
         }
 
+        block_map_free(pe->blocks);
+        pe->blocks = NULL;
+        ram_drop(pe);
+
+        /* the permissions of the cache file follow the remote ones */
+        mode_str = dpl_dict_get_value(metadata, "mode");
+        if (mode_str)
+                mode = strtoul(mode_str, NULL, 10);
+
+        if (sparse_candidate(metadata, object_size(headers))) {
+                fd = open_sparse(pe, local, object_size(headers), mode);
+                goto end;
+        }
+
+  download:
+        /* the headers took long enough, nobody will read it */
+        if (dfs_interrupted()) {
+                LOG(LOG_NOTICE, "%s: interrupted", remote);
+                download_rollback(pe, local);
+                fd = -1;
+                goto end;
+        }
+
         get_data.fd = open(local, O_RDWR|O_CREAT|O_TRUNC, mode);
         if (-1 == get_data.fd) {
                 LOG(LOG_ERR, "open: %s: %s (%d)",
@@ -445,11 +676,7 @@ dfs_get_local_copy(tpath_entry *pe,
 
         /* try to change the permissions of the local file according to the
          * remote ones */
-        mode_str = dpl_dict_get_value(metadata, "mode");
-
         if (mode_str) {
-                mode = strtoul(mode_str, NULL, 10);
-
                 if (-1 == fchmod(get_data.fd, mode)) {
                         LOG(LOG_ERR, "fchmod: %s: %s (%d)",
                             local, strerror(errno), errno);
@@ -461,23 +688,56 @@ dfs_get_local_copy(tpath_entry *pe,
 
         encryption = check_encryption_flag(metadata);
 
-        rc = dpl_openread(ctx,
+        throttle_enter(&throttle, 0);
+        ep = endpoint_get();
+        rc = dpl_openread(endpoint_ctx(ep),
                           (char *)remote,
                           encryption,
                           NULL,
                           cb_get_buffered,
                           &get_data,
                           &metadata);
+        /* cut short on our side, the store has nothing to do with it */
+        if (DPL_SUCCESS != rc && EINTR == get_data.error)
+                rc = DFS_EINTR;
+        endpoint_put(ep, rc, NULL);
+        throttle_leave(&throttle, rc);
 
         if (DPL_SUCCESS != rc) {
                 LOG(LOG_ERR, "dpl_openread: %s", dpl_status_str(rc));
                 (void) safe_close(get_data.fd);
                 fd = -1;
+
+                if (ENOSPC == get_data.error) {
+                        /* the cache filesystem is full: drop the partial
+                         * copy, make some room and try once more */
+                        if (-1 == unlink(local))
+                                LOG(LOG_ERR, "unlink(%s): %s",
+                                    local, strerror(errno));
+
+                        if (! reclaimed++ &&
+                            lru_reclaim(object_size(headers))) {
+                                get_data.error = 0;
+                                goto download;
+                        }
+
+                        /* still no room, read the remote object without
+                         * caching it */
+                        if (pentry_get_refcount(pe) <= 1 &&
+                            can_stream(metadata, object_size(headers))) {
+                                LOG(LOG_NOTICE, "%s: no room in the cache, "
+                                    "stream it", remote);
+                                pe->stream = 1;
+                        }
+                }
+
+                download_rollback(pe, local);
                 goto end;
         }
 
         /* If the file is compressed, uncompress it! */
         if(-1 == handle_compression(remote, local, &get_data, metadata)) {
+                download_rollback(pe, local);
                 fd = -1;
                 goto end;
         }
@@ -489,6 +749,12 @@ dfs_get_local_copy(tpath_entry *pe,
                 goto end;
         }
 
+        /* new content, the kernel has to drop its page cache */
+        pe->keep_cache = 0;
+
+        /* serve it anyway, but only keep it if it is worth it */
+        pe->transient = ! lru_admit(pe, object_size(headers));
+
         fd = open(local, flags, 0600);
         if (-1 == fd) {
                 LOG(LOG_ERR, "open(path=%s, fd=%d): %s",
@@ -504,5 +770,7 @@ dfs_get_local_copy(tpath_entry *pe,
         if (headers)
                 dpl_dict_free(headers);
 
+        free(local);
+
         return fd;
 }
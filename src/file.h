@@ -9,15 +9,18 @@
 struct get_data {
         struct buf *buf;
         int fd;
+        int error; /* errno of the failed local write */
 };
 
 int safe_close(int fd);
 char *ftype_to_str(dpl_ftype_t);
 char *flags_to_str(int);
 int write_all(int, char *, int);
-int read_write_all_vfile(int, dpl_vfile_t *);
+int read_write_all_vfile(int, dpl_vfile_t *, dpl_status_t *);
 int cb_get_buffered(void *, char *, unsigned);
 /* return the fd of a local copy, to operate on */
 int dfs_get_local_copy(tpath_entry *, const char *, int);
+/* read a range of the remote object, for entries without cache file */
+int dfs_read_remote(tpath_entry *, char *, size_t, off_t);
 
 #endif
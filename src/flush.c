@@ -0,0 +1,28 @@
+#include <errno.h>
+
+#include "flush.h"
+#include "hash.h"
+#include "log.h"
+
+/* the cache file is uploaded on release, there is nothing to push on each
+ * close() of a duplicated descriptor */
+int
+dfs_flush(const char *path,
+          struct fuse_file_info *info)
+{
+        tpath_entry *pe = NULL;
+        int ret;
+
+        pe = (tpath_entry *)info->fh;
+        if (! pe) {
+                LOG(LOG_INFO, "no path entry");
+                ret = -EBADF;
+                goto end;
+        }
+
+        LOG(LOG_DEBUG, "%s, fd=%d", pe->path, pe->fd);
+
+        ret = 0;
+  end:
+        return ret;
+}
@@ -0,0 +1,8 @@
+#ifndef FLUSH_H
+#define FLUSH_H
+
+#include <fuse.h>
+
+int dfs_flush(const char *, struct fuse_file_info *);
+
+#endif /* FLUSH_H */
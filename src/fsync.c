@@ -1,40 +1,35 @@
 #include <unistd.h>
 #include <errno.h>
-#include <glib.h>
 
 #include "fsync.h"
 #include "hash.h"
 #include "log.h"
 
-extern GHashTable *hash;
-
 int
 dfs_fsync(const char *path,
-          int issync,
+          int datasync,
           struct fuse_file_info *info)
 {
         tpath_entry *pe = NULL;
         int ret;
 
-        LOG(LOG_DEBUG, "%s", path);
-
-        pe = g_hash_table_lookup(hash, path);
+        pe = (tpath_entry *)info->fh;
         if (! pe) {
-                LOG(LOG_INFO, "unable to find a path entry (%s)", path);
-                ret = -1;
+                LOG(LOG_INFO, "no path entry");
+                ret = -EBADF;
                 goto end;
         }
 
+        LOG(LOG_DEBUG, "%s, datasync=%d", pe->path, datasync);
+
         if (-1 == pe->fd) {
                 LOG(LOG_ERR, "unusable file descriptor: %d", pe->fd);
-                ret = -1;
+                ret = -EBADF;
                 goto end;
         }
 
-        if (issync)
-                goto end;
-
-        if (-1 == fsync(pe->fd)) {
+        ret = datasync ? fdatasync(pe->fd) : fsync(pe->fd);
+        if (-1 == ret) {
                 LOG(LOG_ERR, "fsync(fd=%d): %s", pe->fd, strerror(errno));
                 ret = -errno;
                 goto end;
@@ -43,6 +38,6 @@ dfs_fsync(const char *path,
         ret = 0;
 
   end:
-        LOG(LOG_DEBUG, "path=%s ret=%s", path, dpl_status_str(ret));
+        LOG(LOG_DEBUG, "path=%s ret=%s", pe ? pe->path : path, dpl_status_str(ret));
         return ret;
 }
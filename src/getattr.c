@@ -10,6 +10,7 @@
 #include "metadata.h"
 #include "timeout.h"
 #include "list.h"
+#include "delete.h"
 
 extern dpl_ctx_t *ctx;
 extern struct conf *conf;
@@ -128,23 +129,34 @@ getattr_local(tpath_entry *pe,
               struct stat *st)
 {
         int ret;
-
-        LOG(LOG_DEBUG, "%s: get local metadata through fstat(fd=%d)", path, pe->fd);
-
-        if (pe->fd < 0) {
-                LOG(LOG_ERR, "path=%s: invalid fd=%d", path, pe->fd);
-                ret = -1;
+        int fd;
+
+        /* the descriptor was closed to save some, or is being replaced:
+         * the file is still here */
+        fd = pentry_fd_get(pe);
+        if (fd < 0) {
+                LOG(LOG_DEBUG, "%s: get local metadata through stat", path);
+                if (-1 == stat(pentry_cache_path(pe), st)) {
+                        LOG(LOG_ERR, "path=%s: stat: %s", path, strerror(errno));
+                        ret = -1;
+                        goto err;
+                }
+                ret = 0;
                 goto err;
         }
 
-        if (-1 == fstat(pe->fd, st)) {
+        LOG(LOG_DEBUG, "%s: get local metadata through fstat(fd=%d)", path, fd);
+
+        if (-1 == fstat(fd, st)) {
                 LOG(LOG_ERR, "path=%s: fstat(fd=%d, ...): %s",
-                    path, pe->fd, strerror(errno));
+                    path, fd, strerror(errno));
                 ret = -1;
-                goto err;
+                goto put;
         }
 
         ret = 0;
+  put:
+        pentry_fd_put(pe);
   err:
         return ret;
 }
@@ -270,6 +282,12 @@ dfs_getattr(const char *path,
                 goto end;
 	}
 
+        /* removed, the store may not know it yet */
+        if (delete_pending(path)) {
+                ret = -ENOENT;
+                goto end;
+        }
+
         pe = g_hash_table_lookup(hash, path);
         if (! pe) {
                 pe = pentry_new();
@@ -303,3 +321,33 @@ dfs_getattr(const char *path,
         LOG(LOG_DEBUG, "path=%s ret=%s", path, dpl_status_str(ret));
         return ret;
 }
+
+/* open files: work on the handle, neither a path walk nor a hash lookup */
+int
+dfs_fgetattr(const char *path,
+             struct stat *st,
+             struct fuse_file_info *info)
+{
+        tpath_entry *pe = NULL;
+        int ret;
+
+        pe = (tpath_entry *)info->fh;
+        if (! pe) {
+                LOG(LOG_INFO, "no path entry");
+                ret = -EBADF;
+                goto end;
+        }
+
+        LOG(LOG_DEBUG, "path=%s, st=%p", pe->path, (void *)st);
+
+        /* read from the remote object, no cache file */
+        if (FILE_LOCAL != pe->ondisk) {
+                ret = dfs_getattr(pe->path, st);
+                goto end;
+        }
+
+        ret = getattr_local(pe, pe->path, st);
+        pe->atime = time(NULL);
+  end:
+        return ret;
+}
@@ -4,9 +4,11 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fuse.h>
 
 #include "hash.h"
 
 int dfs_getattr(const char *, struct stat *);
+int dfs_fgetattr(const char *, struct stat *, struct fuse_file_info *);
 
 #endif /* GETATTR_H */
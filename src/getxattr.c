@@ -0,0 +1,84 @@
+#include <errno.h>
+#include <string.h>
+
+#include "getxattr.h"
+#include "log.h"
+#include "lru.h"
+#include "pin.h"
+#include "prefetch.h"
+#include "throttle.h"
+#include "endpoint.h"
+#include "breaker.h"
+#include "delete.h"
+#include "rename.h"
+#include "tmpstr.h"
+
+#define XATTR_PIN "user.dplfs.pin"
+#define XATTR_PINNED_BYTES "user.dplfs.pinned_bytes"
+#define XATTR_PREFETCH "user.dplfs.prefetch"
+#define XATTR_BACKEND "user.dplfs.backend"
+#define XATTR_ENDPOINTS "user.dplfs.endpoints"
+#define XATTR_OFFLINE "user.dplfs.offline"
+#define XATTR_DELETES "user.dplfs.deletes"
+#define XATTR_RENAME "user.dplfs.rename"
+
+/* the size of the value if `size' is zero, its copy otherwise */
+static int
+xattr_reply(const char *str,
+            char *value,
+            size_t size)
+{
+        size_t len = strlen(str);
+
+        if (! size)
+                return len;
+
+        if (size < len)
+                return -ERANGE;
+
+        memcpy(value, str, len);
+
+        return len;
+}
+
+int
+dfs_getxattr(const char *path,
+             const char *name,
+             char *value,
+             size_t size)
+{
+        char *progress = NULL;
+
+        LOG(LOG_DEBUG, "path=%s, name=%s, size=%zu", path, name, size);
+
+        if (! strcmp(name, XATTR_PIN))
+                return xattr_reply(pin_match(path) ? "1" : "0", value, size);
+
+        if (! strcmp(name, XATTR_PINNED_BYTES))
+                return xattr_reply(tmpstr_printf("%llu", lru_get_pinned_bytes()),
+                                   value, size);
+
+        if (! strcmp(name, XATTR_BACKEND))
+                return xattr_reply(throttle_stats(), value, size);
+
+        if (! strcmp(name, XATTR_ENDPOINTS))
+                return xattr_reply(endpoint_stats(), value, size);
+
+        if (! strcmp(name, XATTR_OFFLINE))
+                return xattr_reply(breaker_stats(), value, size);
+
+        if (! strcmp(name, XATTR_DELETES))
+                return xattr_reply(delete_stats(), value, size);
+
+        if (! strcmp(name, XATTR_RENAME))
+                return xattr_reply(rename_progress(), value, size);
+
+        if (! strcmp(name, XATTR_PREFETCH)) {
+                progress = prefetch_progress(path);
+                if (! progress)
+                        return -ENODATA;
+                return xattr_reply(progress, value, size);
+        }
+
+        return 0;
+}
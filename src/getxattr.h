@@ -0,0 +1,8 @@
+#ifndef GETXATTR_H
+#define GETXATTR_H
+
+#include <sys/types.h>
+
+int dfs_getxattr(const char *, const char *, char *, size_t);
+
+#endif /* GETXATTR_H */
@@ -10,6 +10,10 @@
 #include "tmpstr.h"
 #include "list.h"
 #include "utils.h"
+#include "lru.h"
+#include "block.h"
+#include "ram.h"
+#include "local.h"
 
 extern GHashTable *hash;
 extern struct conf *conf;
@@ -28,6 +32,11 @@ pentry_new(void)
                 return NULL;
         }
 
+        pe->lru_link = NULL;
+        pe->cache_size = 0;
+        pe->lru_time = 0;
+        pe->last_access = 0;
+
         rc = sem_init(&pe->refcount, 0, 0);
         if (-1 == rc) {
                 LOG(LOG_INFO, "sem_init sem@%p: %s",
@@ -69,7 +78,13 @@ pentry_new(void)
         pe->dirent = NULL;
         pe->path = NULL;
         pe->exclude = 0;
-        pe->flag = FLAG_DIRTY;
+        pe->keep_cache = 0;
+        pe->stream = 0;
+        pe->transient = 0;
+        pe->blocks = NULL;
+        pe->ram = NULL;
+        pe->bytes_read = 0;
+        pe->flag = FLAG_CLEAN;
 
         return pe;
 
@@ -81,8 +96,10 @@ pentry_new(void)
 void
 pentry_free(tpath_entry *pe)
 {
-        if (-1 != pe->fd)
-                safe_close(pe->fd);
+        lru_remove(pe);
+        ram_drop(pe);
+        lru_set_fd(pe, -1);
+        block_map_free(pe->blocks);
 
         if (pe->usermd)
                 dpl_dict_free(pe->usermd);
@@ -168,6 +185,14 @@ pentry_add_dirent(tpath_entry *pe,
                 pe->dirent = list_add(pe->dirent, key);
 }
 
+char *
+pentry_cache_path(tpath_entry *pe)
+{
+        assert(pe);
+
+        return local_path(pe->path);
+}
+
 void
 pentry_unlink_cache_file(tpath_entry *pe)
 {
@@ -178,7 +203,7 @@ pentry_unlink_cache_file(tpath_entry *pe)
         if (! pe->path)
                 return;
 
-        local = tmpstr_printf("%s/%s", conf->cache_dir, pe->path);
+        local = pentry_cache_path(pe);
 
         if (-1 == unlink(local))
                 LOG(LOG_INFO, "unlink(%s): %s", local, strerror(errno));
@@ -334,6 +359,29 @@ pentry_unlock(tpath_entry *pe)
         pentry_gen_unlock(pe, &pe->mutex);
 }
 
+int
+pentry_fd_get(tpath_entry *pe)
+{
+        assert(pe);
+
+        /* parking, or a download: don't wait for it */
+        if (pentry_trylock(pe))
+                return -1;
+
+        if (pe->fd < 0) {
+                pentry_unlock(pe);
+                return -1;
+        }
+
+        return pe->fd;
+}
+
+void
+pentry_fd_put(tpath_entry *pe)
+{
+        pentry_unlock(pe);
+}
+
 int
 pentry_md_trylock(tpath_entry *pe)
 {
@@ -401,6 +449,36 @@ pentry_set_digest(tpath_entry *pe,
         return 0;
 }
 
+static int
+usermd_value_differs(dpl_dict_t *old,
+                     dpl_dict_t *new,
+                     char *name)
+{
+        char *v1 = NULL;
+        char *v2 = NULL;
+
+        v1 = dpl_dict_get_value(old, name);
+        v2 = dpl_dict_get_value(new, name);
+
+        if (! v1 || ! v2)
+                return v1 != v2;
+
+        return 0 != strcmp(v1, v2);
+}
+
+int
+pentry_usermd_changed(tpath_entry *pe,
+                      dpl_dict_t *dict)
+{
+        assert(pe);
+
+        if (! pe->usermd || ! dict)
+                return 0;
+
+        return usermd_value_differs(pe->usermd, dict, "size") ||
+                usermd_value_differs(pe->usermd, dict, "mtime");
+}
+
 char *
 pentry_type_to_str(tpath_type type)
 {
@@ -12,6 +12,7 @@
 enum {
         FLAG_CLEAN=0,
         FLAG_DIRTY,
+        FLAG_STALE, /* the remote object changed, revalidate on next open */
 };
 
 typedef enum {
@@ -26,6 +27,9 @@ enum {
         FILE_UNSET,
 };
 
+struct block_map;
+struct ram_copy;
+
 /* path entry on remote storage file system */
 typedef struct {
         int fd;
@@ -41,6 +45,16 @@ typedef struct {
         tpath_type filetype;
         struct list *dirent;
         int ondisk;
+        int keep_cache; /* kernel page cache still matches the cache file */
+        int stream; /* no room in the cache, read the remote object */
+        int transient; /* not admitted in the cache, drop after use */
+        GList *lru_link; /* position in the disk cache recency list */
+        off_t cache_size; /* bytes of the cache file, as accounted */
+        time_t lru_time; /* when it was moved in the recency list */
+        time_t last_access; /* last I/O on the cache file */
+        struct block_map *blocks; /* sparse cache file, or NULL */
+        struct ram_copy *ram; /* content in the memory tier, or NULL */
+        unsigned long long bytes_read; /* since the last release */
         time_t atime, mtime, ctime;
 } tpath_entry;
 
@@ -56,11 +70,18 @@ void pentry_add_dirent(tpath_entry *, const char *);
 struct list;
 struct list *pentry_get_dirents(tpath_entry *);
 
+/* path of the cache file, in a temporary string */
+char *pentry_cache_path(tpath_entry *);
 void pentry_unlink_cache_file(tpath_entry *);
 
 int pentry_trylock(tpath_entry *);
 void pentry_lock(tpath_entry *);
 void pentry_unlock(tpath_entry *);
+/* the cache file descriptor, with the entry locked so that it is neither
+ * parked nor replaced while in use: pentry_fd_put() after it; -1, and not
+ * locked, if it has none or the entry is busy */
+int pentry_fd_get(tpath_entry *);
+void pentry_fd_put(tpath_entry *);
 int pentry_md_trylock(tpath_entry *);
 void pentry_md_lock(tpath_entry *);
 void pentry_md_unlock(tpath_entry *);
@@ -79,6 +100,9 @@ int pentry_set_usermd(tpath_entry *, dpl_dict_t *);
 /* return 0 on success, -1 on failure */
 int pentry_set_digest(tpath_entry *, const char *);
 
+/* return 1 if the size or mtime of `dict' differs from the entry ones */
+int pentry_usermd_changed(tpath_entry *, dpl_dict_t *);
+
 tpath_entry *pentry_get_parent(tpath_entry *pe);
 
 int populate_hash(GHashTable *h,
@@ -0,0 +1,552 @@
+#include <errno.h>
+#include <glib.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "hedge.h"
+#include "log.h"
+#include "throttle.h"
+#include "endpoint.h"
+#include "timeout.h"
+
+/* latencies kept, per class of request, to estimate the percentile */
+#define HEDGE_SAMPLES 512
+/* no hedging before that many answers */
+#define HEDGE_MIN_SAMPLES 64
+/* the threshold is computed again after this many answers */
+#define HEDGE_REFRESH 32
+/* hedges that can be sent in a row, when the budget was not used */
+#define HEDGE_BURST 10
+/* how often a waiting caller looks for an interruption, in ms */
+#define HEDGE_SLICE 50
+
+extern struct conf *conf;
+
+enum hedge_class {
+        HEDGE_META,
+        HEDGE_DATA,
+        HEDGE_NCLASSES,
+};
+
+enum hedge_op {
+        HEDGE_GETATTR,
+        HEDGE_GETATTR_RAW,
+        HEDGE_HEAD_ALL,
+        HEDGE_RANGE,
+};
+
+struct hedge_stats {
+        int samples[HEDGE_SAMPLES]; /* in ms */
+        unsigned int count;
+        int threshold; /* in ms, 0 until we know enough */
+};
+
+struct hedge;
+
+/* one attempt, and what it brought back */
+struct hedge_call {
+        struct hedge *h;
+        dpl_status_t rc;
+        dpl_dict_t *metadata;
+        char *data;
+        unsigned int data_len;
+        struct throttle throttle; /* the caller counts the first attempt */
+        int throttled;
+};
+
+/* A request, owned by its caller and by each running attempt: the slow
+ * one may still be waiting for its answer after the caller returned. */
+struct hedge {
+        enum hedge_class class;
+        enum hedge_op op;
+        char *bucket;
+        char *path;
+        char *subresource;
+        dpl_condition_t condition;
+        int has_condition;
+        int start;
+        int end;
+
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+        int refcount;
+        int pending; /* attempts still running */
+        struct hedge_call *winner;
+        struct hedge_call calls[2];
+};
+
+static GThreadPool *hedge_pool = NULL;
+
+static struct hedge_stats stats[HEDGE_NCLASSES];
+/* in hundredths of a hedge, each request brings hedge_budget of them */
+static int hedge_credit = 0;
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int
+cmp_int(const void *a,
+        const void *b)
+{
+        return *(const int *)a - *(const int *)b;
+}
+
+/* called with stats_mutex held */
+static void
+hedge_refresh(struct hedge_stats *st)
+{
+        int sorted[HEDGE_SAMPLES];
+        unsigned int n;
+
+        n = st->count < HEDGE_SAMPLES ? st->count : HEDGE_SAMPLES;
+        memcpy(sorted, st->samples, n * sizeof *sorted);
+        qsort(sorted, n, sizeof *sorted, cmp_int);
+
+        st->threshold = sorted[(n - 1) * conf->hedge_percentile / 100];
+        if (st->threshold < 1)
+                st->threshold = 1;
+}
+
+static void
+hedge_record(enum hedge_class class,
+             int ms)
+{
+        struct hedge_stats *st = &stats[class];
+
+        pthread_mutex_lock(&stats_mutex);
+
+        st->samples[st->count % HEDGE_SAMPLES] = ms;
+        st->count++;
+
+        if (st->count >= HEDGE_MIN_SAMPLES && 0 == st->count % HEDGE_REFRESH)
+                hedge_refresh(st);
+
+        pthread_mutex_unlock(&stats_mutex);
+}
+
+/* return the delay before hedging a new request, 0 for never */
+static int
+hedge_start(enum hedge_class class)
+{
+        int threshold;
+
+        pthread_mutex_lock(&stats_mutex);
+
+        hedge_credit += conf->hedge_budget;
+        if (hedge_credit > HEDGE_BURST * 100)
+                hedge_credit = HEDGE_BURST * 100;
+
+        threshold = stats[class].threshold;
+
+        pthread_mutex_unlock(&stats_mutex);
+
+        return threshold;
+}
+
+/* so that a slow server does not get twice the load */
+static int
+hedge_take_credit(void)
+{
+        int ret = 0;
+
+        pthread_mutex_lock(&stats_mutex);
+
+        if (hedge_credit >= 100) {
+                hedge_credit -= 100;
+                ret = 1;
+        }
+
+        pthread_mutex_unlock(&stats_mutex);
+
+        return ret;
+}
+
+/* the hedge was not sent after all */
+static void
+hedge_refund_credit(void)
+{
+        pthread_mutex_lock(&stats_mutex);
+
+        hedge_credit += 100;
+        if (hedge_credit > HEDGE_BURST * 100)
+                hedge_credit = HEDGE_BURST * 100;
+
+        pthread_mutex_unlock(&stats_mutex);
+}
+
+static int
+elapsed_ms(struct timespec *start)
+{
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        return (now.tv_sec - start->tv_sec) * 1000 +
+                (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static dpl_status_t
+hedge_attempt(struct hedge *h,
+              struct hedge_call *call,
+              dpl_ctx_t *ctx)
+{
+        switch (h->op) {
+        case HEDGE_GETATTR:
+                return dpl_getattr(ctx, h->path, &call->metadata);
+        case HEDGE_GETATTR_RAW:
+                return dpl_getattr_raw(ctx, h->path, &call->metadata);
+        case HEDGE_HEAD_ALL:
+                return dpl_head_all(ctx, h->bucket, h->path,
+                                    h->subresource,
+                                    h->has_condition ? &h->condition : NULL,
+                                    &call->metadata);
+        case HEDGE_RANGE:
+                return dpl_openread_range(ctx, h->path, 0, NULL,
+                                          h->start, h->end, &call->data,
+                                          &call->data_len, NULL);
+        }
+
+        return DPL_EINVAL;
+}
+
+static void
+hedge_discard(struct hedge_call *call)
+{
+        if (call->metadata) {
+                dpl_dict_free(call->metadata);
+                call->metadata = NULL;
+        }
+
+        free(call->data);
+        call->data = NULL;
+}
+
+static void
+hedge_unref(struct hedge *h)
+{
+        int last;
+
+        pthread_mutex_lock(&h->mutex);
+        last = ! --h->refcount;
+        pthread_mutex_unlock(&h->mutex);
+
+        if (! last)
+                return;
+
+        hedge_discard(&h->calls[0]);
+        hedge_discard(&h->calls[1]);
+        pthread_mutex_destroy(&h->mutex);
+        pthread_cond_destroy(&h->cond);
+        free(h->bucket);
+        free(h->path);
+        free(h->subresource);
+        free(h);
+}
+
+static void
+hedge_worker(gpointer data,
+             gpointer user_data)
+{
+        struct hedge_call *call = data;
+        struct hedge *h = call->h;
+        struct endpoint *ep = NULL;
+        struct timespec start;
+
+        (void)user_data;
+
+        ep = endpoint_get();
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        call->rc = hedge_attempt(h, call, endpoint_ctx(ep));
+        endpoint_put(ep, call->rc, HEDGE_META == h->class ? &start : NULL);
+        hedge_record(h->class, elapsed_ms(&start));
+
+        if (call->throttled)
+                throttle_leave(&call->throttle, call->rc);
+
+        pthread_mutex_lock(&h->mutex);
+
+        h->pending--;
+
+        /* an error only wins when there is no other answer to wait for */
+        if (! h->winner && (DPL_SUCCESS == call->rc || ! h->pending)) {
+                h->winner = call;
+                pthread_cond_signal(&h->cond);
+        } else {
+                hedge_discard(call);
+        }
+
+        pthread_mutex_unlock(&h->mutex);
+
+        hedge_unref(h);
+}
+
+static struct hedge *
+hedge_new(enum hedge_class class,
+          enum hedge_op op,
+          const char *path)
+{
+        struct hedge *h = NULL;
+
+        h = calloc(1, sizeof *h);
+        if (! h) {
+                LOG(LOG_ERR, "calloc: %s", strerror(errno));
+                return NULL;
+        }
+
+        h->path = strdup(path);
+        if (! h->path) {
+                LOG(LOG_ERR, "strdup(%s): %s", path, strerror(errno));
+                free(h);
+                return NULL;
+        }
+
+        h->class = class;
+        h->op = op;
+        h->calls[0].h = h;
+        h->calls[1].h = h;
+        pthread_mutex_init(&h->mutex, NULL);
+        pthread_cond_init(&h->cond, NULL);
+
+        return h;
+}
+
+/* wait for an attempt to signal, `ms' at most, h->mutex held */
+static void
+hedge_wait(struct hedge *h,
+           int ms)
+{
+        struct timespec deadline;
+
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += ms / 1000;
+        deadline.tv_nsec += (ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+        }
+
+        while (! h->winner &&
+               ETIMEDOUT != pthread_cond_timedwait(&h->cond, &h->mutex,
+                                                   &deadline))
+                ;
+}
+
+/* send the request, and a copy of it if it takes too long; return the
+ * winning attempt, or NULL if the caller was interrupted meanwhile, the
+ * attempts then finish on their own; h->mutex held */
+static struct hedge_call *
+hedge_run(struct hedge *h)
+{
+        int threshold;
+
+        threshold = hedge_start(h->class);
+
+        pthread_mutex_lock(&h->mutex);
+
+        h->refcount = 2; /* the caller and the first attempt */
+        h->pending = 1;
+        g_thread_pool_push(hedge_pool, &h->calls[0], NULL);
+
+        if (threshold) {
+                hedge_wait(h, threshold);
+
+                /* never while the store is asking us to slow down, which
+                 * gives the credit back */
+                if (! h->winner && hedge_take_credit()) {
+                        if (throttle_try_enter(&h->calls[1].throttle,
+                                               HEDGE_META == h->class)) {
+                                hedge_refund_credit();
+                        } else {
+                                h->calls[1].throttled = 1;
+                                LOG(LOG_DEBUG, "%s: no answer after %dms, "
+                                    "hedging", h->path, threshold);
+                                h->refcount++;
+                                h->pending++;
+                                g_thread_pool_push(hedge_pool, &h->calls[1],
+                                                   NULL);
+                        }
+                }
+        }
+
+        while (! h->winner) {
+                if (dfs_interrupted()) {
+                        LOG(LOG_NOTICE, "%s: interrupted", h->path);
+                        return NULL;
+                }
+                hedge_wait(h, HEDGE_SLICE);
+        }
+
+        return h->winner;
+}
+
+/* give the results of the winner to the caller, and let the attempts go */
+static dpl_status_t
+hedge_done(struct hedge *h,
+           struct hedge_call *call,
+           dpl_dict_t **metadatap,
+           char **datap,
+           unsigned int *data_lenp)
+{
+        dpl_status_t rc;
+
+        if (! call) {
+                rc = DFS_EINTR;
+                goto end;
+        }
+
+        rc = call->rc;
+
+        if (metadatap) {
+                *metadatap = call->metadata;
+                call->metadata = NULL;
+        }
+
+        if (datap) {
+                *datap = call->data;
+                *data_lenp = call->data_len;
+                call->data = NULL;
+        }
+
+  end:
+        pthread_mutex_unlock(&h->mutex);
+        hedge_unref(h);
+
+        return rc;
+}
+
+dpl_status_t
+hedge_getattr(const char *path,
+              int all_headers,
+              dpl_dict_t **metadatap)
+{
+        struct hedge *h = NULL;
+        struct endpoint *ep = NULL;
+        struct timespec start;
+        dpl_status_t rc;
+
+        if (! hedge_pool)
+                goto direct;
+
+        h = hedge_new(HEDGE_META,
+                      all_headers ? HEDGE_GETATTR_RAW : HEDGE_GETATTR, path);
+        if (! h)
+                goto direct;
+
+        return hedge_done(h, hedge_run(h), metadatap, NULL, NULL);
+
+  direct:
+        ep = endpoint_get();
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        if (all_headers)
+                rc = dpl_getattr_raw(endpoint_ctx(ep), (char *)path,
+                                     metadatap);
+        else
+                rc = dpl_getattr(endpoint_ctx(ep), (char *)path, metadatap);
+        endpoint_put(ep, rc, &start);
+
+        return rc;
+}
+
+dpl_status_t
+hedge_head_all(char *bucket,
+               char *resource,
+               char *subresource,
+               dpl_condition_t *condition,
+               dpl_dict_t **metadatap)
+{
+        struct hedge *h = NULL;
+        struct endpoint *ep = NULL;
+        struct timespec start;
+        dpl_status_t rc;
+
+        if (! hedge_pool)
+                goto direct;
+
+        h = hedge_new(HEDGE_META, HEDGE_HEAD_ALL, resource);
+        if (! h)
+                goto direct;
+
+        if (bucket)
+                h->bucket = strdup(bucket);
+        if (subresource)
+                h->subresource = strdup(subresource);
+        if ((bucket && ! h->bucket) || (subresource && ! h->subresource)) {
+                LOG(LOG_ERR, "strdup: %s", strerror(errno));
+                h->refcount = 1;
+                hedge_unref(h);
+                goto direct;
+        }
+
+        if (condition) {
+                h->condition = *condition;
+                h->has_condition = 1;
+        }
+
+        return hedge_done(h, hedge_run(h), metadatap, NULL, NULL);
+
+  direct:
+        ep = endpoint_get();
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        rc = dpl_head_all(endpoint_ctx(ep), bucket, resource, subresource,
+                          condition, metadatap);
+        endpoint_put(ep, rc, &start);
+
+        return rc;
+}
+
+dpl_status_t
+hedge_openread_range(const char *path,
+                     int start,
+                     int end,
+                     char **data_bufp,
+                     unsigned int *data_lenp)
+{
+        struct hedge *h = NULL;
+        struct endpoint *ep = NULL;
+        dpl_status_t rc;
+
+        if (! hedge_pool)
+                goto direct;
+
+        h = hedge_new(HEDGE_DATA, HEDGE_RANGE, path);
+        if (! h)
+                goto direct;
+
+        h->start = start;
+        h->end = end;
+
+        return hedge_done(h, hedge_run(h), NULL, data_bufp, data_lenp);
+
+  direct:
+        ep = endpoint_get();
+        rc = dpl_openread_range(endpoint_ctx(ep), (char *)path, 0, NULL,
+                                start, end, data_bufp, data_lenp, NULL);
+        endpoint_put(ep, rc, NULL);
+
+        return rc;
+}
+
+int
+hedge_init(void)
+{
+        GError *err = NULL;
+
+        if (! conf->hedge_percentile)
+                return 0;
+
+        if (conf->hedge_percentile < 0 || conf->hedge_percentile > 100) {
+                LOG(LOG_ERR, "invalid hedge percentile: %d",
+                    conf->hedge_percentile);
+                return -1;
+        }
+
+        /* as many threads as requests in flight, idle ones are reused */
+        hedge_pool = g_thread_pool_new(hedge_worker, NULL, -1, FALSE, &err);
+        if (err) {
+                LOG(LOG_ERR, "hedge thread pool creation: %s", err->message);
+                hedge_pool = NULL;
+                return -1;
+        }
+
+        return 0;
+}
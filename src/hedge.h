@@ -0,0 +1,16 @@
+#ifndef HEDGE_H
+#define HEDGE_H
+
+#include <droplet.h>
+
+/* Idempotent requests, sent a second time on another connection when the
+ * first one is slower than usual; the first answer wins.  Without
+ * hedge_init(), they are plain libdroplet calls. */
+int hedge_init(void);
+
+/* each attempt goes to the endpoint given by endpoint_get() */
+dpl_status_t hedge_getattr(const char *, int, dpl_dict_t **);
+dpl_status_t hedge_head_all(char *, char *, char *, dpl_condition_t *, dpl_dict_t **);
+dpl_status_t hedge_openread_range(const char *, int, int, char **, unsigned int *);
+
+#endif /* HEDGE_H */
@@ -0,0 +1,129 @@
+#include <errno.h>
+#include <glib.h>
+#include <libgen.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "local.h"
+#include "log.h"
+#include "misc.h"
+#include "tmpstr.h"
+
+#define FLAT "flat"
+#define FLAT_LEN strlen(FLAT)
+
+extern struct conf *conf;
+
+int
+local_layout_is_flat(void)
+{
+        return ! strncasecmp(conf->cache_layout, FLAT, FLAT_LEN);
+}
+
+/* the same remote file can be named "/a/b" or "a/b" */
+static const char *
+skip_slashes(const char *path)
+{
+        while (path && '/' == *path)
+                path++;
+
+        return path;
+}
+
+char *
+local_path(const char *path)
+{
+        char *digest = NULL;
+        char *local = NULL;
+
+        path = skip_slashes(path);
+
+        if (! local_layout_is_flat())
+                return tmpstr_printf("%s/%s", conf->cache_dir, path);
+
+        digest = g_compute_checksum_for_string(G_CHECKSUM_MD5, path, -1);
+        if (! digest) {
+                LOG(LOG_CRIT, "%s: can't compute the MD5 digest", path);
+                return NULL;
+        }
+
+        local = tmpstr_printf("%s/%.2s/%.2s/%s",
+                              conf->cache_dir, digest, digest + 2, digest);
+        g_free(digest);
+
+        return local;
+}
+
+/* at most a stat() and two mkdir() */
+static void
+local_prepare_flat(const char *local)
+{
+        char *shard = NULL;
+        char *top = NULL;
+        struct stat st;
+
+        shard = tmpstr_printf("%s", local);
+        *strrchr(shard, '/') = 0;
+
+        if (0 == stat(shard, &st))
+                return;
+
+        if (ENOENT != errno) {
+                LOG(LOG_ERR, "stat(%s): %s", shard, strerror(errno));
+                return;
+        }
+
+        top = tmpstr_printf("%s", shard);
+        *strrchr(top, '/') = 0;
+
+        if (-1 == mkdir(top, S_IRWXU) && EEXIST != errno)
+                LOG(LOG_ERR, "mkdir(%s): %s", top, strerror(errno));
+
+        if (-1 == mkdir(shard, S_IRWXU) && EEXIST != errno)
+                LOG(LOG_ERR, "mkdir(%s): %s", shard, strerror(errno));
+}
+
+static void
+local_prepare_tree(const char *local)
+{
+        char *tmp_local = NULL;
+        char *dir = NULL;
+        struct stat st;
+
+        tmp_local = strdup(local);
+        if (! tmp_local) {
+                LOG(LOG_CRIT, "strdup(%s): %s", local, strerror(errno));
+                return;
+        }
+
+        dir = tmpstr_printf("%s", dirname(tmp_local));
+        if (-1 == stat(dir, &st)) {
+                if (ENOENT == errno)
+                        mkdir_tree(dir);
+                else
+                        LOG(LOG_ERR, "stat(%s): %s", dir, strerror(errno));
+        }
+
+        free(tmp_local);
+}
+
+char *
+local_prepare(const char *path)
+{
+        char *local = NULL;
+
+        LOG(LOG_DEBUG, "building cache dir for '%s'", path);
+
+        local = local_path(path);
+        if (! local)
+                return NULL;
+
+        if (local_layout_is_flat())
+                local_prepare_flat(local);
+        else
+                local_prepare_tree(local);
+
+        return local;
+}
@@ -0,0 +1,16 @@
+#ifndef LOCAL_H
+#define LOCAL_H
+
+/* where the cache file of a remote path lives: either the same tree under
+ * cache_dir ("tree" layout), or <cache_dir>/ab/cd/<md5 of the path>
+ * ("flat" layout) */
+
+int local_layout_is_flat(void);
+
+/* return the cache file path, in a temporary string */
+char *local_path(const char *);
+
+/* same, but create the missing directories first */
+char *local_prepare(const char *);
+
+#endif /* LOCAL_H */
@@ -0,0 +1,625 @@
+#include <assert.h>
+#include <glib.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/statvfs.h>
+
+#include "lru.h"
+#include "hash.h"
+#include "block.h"
+#include "ram.h"
+#include "pin.h"
+#include "file.h"
+#include "log.h"
+#include "sketch.h"
+#include "tmpstr.h"
+
+/* start evicting above HIWAT percent of the budget, stop below LOWAT */
+#define LRU_HIWAT 95
+#define LRU_LOWAT 85
+/* how deep in the cold end we look for an admission victim */
+#define LRU_VICTIM_SCAN 8
+/* once over max_open_files, park descriptors down to this percentage */
+#define LRU_FD_LOWAT 90
+
+extern struct conf *conf;
+
+static GQueue lru = G_QUEUE_INIT;
+static pthread_mutex_t lru_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t evict_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long lru_bytes = 0;
+static volatile gint lru_fds = 0;
+
+unsigned long long
+lru_get_bytes(void)
+{
+        return lru_bytes;
+}
+
+unsigned long long
+lru_get_pinned_bytes(void)
+{
+        GList *link = NULL;
+        tpath_entry *pe = NULL;
+        unsigned long long pinned = 0;
+
+        pthread_mutex_lock(&lru_mutex);
+
+        for (link = g_queue_peek_head_link(&lru); link; link = link->next) {
+                pe = link->data;
+                if (pin_match(pe->path))
+                        pinned += pe->cache_size;
+        }
+
+        pthread_mutex_unlock(&lru_mutex);
+
+        return pinned;
+}
+
+static int
+lru_over_hiwat(void)
+{
+        if (! conf->disk_cache_size)
+                return 0;
+
+        return lru_bytes > conf->disk_cache_size / 100 * LRU_HIWAT;
+}
+
+/* how many bytes we have to release to get back under the watermarks */
+static unsigned long long
+lru_bytes_to_free(void)
+{
+        unsigned long long need = 0;
+        unsigned long long total;
+        unsigned long long avail;
+        unsigned long long min_free;
+        struct statvfs svfs;
+
+        if (conf->disk_cache_size && lru_over_hiwat())
+                need = lru_bytes - conf->disk_cache_size / 100 * LRU_LOWAT;
+
+        if (! conf->disk_cache_min_free)
+                goto end;
+
+        if (-1 == statvfs(conf->cache_dir, &svfs)) {
+                LOG(LOG_ERR, "statvfs(%s): %s", conf->cache_dir, strerror(errno));
+                goto end;
+        }
+
+        total = (unsigned long long)svfs.f_blocks * svfs.f_frsize;
+        avail = (unsigned long long)svfs.f_bavail * svfs.f_frsize;
+        min_free = total / 100 * conf->disk_cache_min_free;
+
+        if (avail < min_free && min_free - avail > need)
+                need = min_free - avail;
+
+  end:
+        return need;
+}
+
+void
+lru_set_fd(tpath_entry *pe,
+           int fd)
+{
+        assert(pe);
+
+        if (fd == pe->fd)
+                return;
+
+        if (-1 != pe->fd) {
+                (void)safe_close(pe->fd);
+                g_atomic_int_add(&lru_fds, -1);
+        }
+
+        pe->fd = fd;
+
+        if (-1 != fd)
+                g_atomic_int_inc(&lru_fds);
+}
+
+/* Close the descriptors of the coldest unreferenced cache files. The files
+ * stay on disk and in the recency list, open() reopens them by path. */
+static void
+lru_park(void)
+{
+        GList *link = NULL;
+        tpath_entry *pe = NULL;
+        int lowat;
+        int parked = 0;
+
+        lowat = conf->max_open_files / 100 * LRU_FD_LOWAT;
+
+        pthread_mutex_lock(&lru_mutex);
+
+        for (link = g_queue_peek_tail_link(&lru);
+             link && g_atomic_int_get(&lru_fds) > lowat;
+             link = link->prev) {
+                pe = link->data;
+
+                if (-1 == pe->fd || pentry_get_refcount(pe))
+                        continue;
+
+                if (FLAG_DIRTY == pe->flag)
+                        continue;
+
+                if (pentry_trylock(pe))
+                        continue;
+
+                lru_set_fd(pe, -1);
+                parked++;
+
+                pentry_unlock(pe);
+        }
+
+        pthread_mutex_unlock(&lru_mutex);
+
+        LOG(LOG_INFO, "%d cache file descriptors closed, %d still open",
+            parked, g_atomic_int_get(&lru_fds));
+}
+
+static off_t
+lru_file_size(tpath_entry *pe)
+{
+        struct stat st;
+
+        /* parked, the file did not change since it was closed */
+        if (pe->fd < 0)
+                return pe->cache_size;
+
+        if (-1 == fstat(pe->fd, &st)) {
+                LOG(LOG_ERR, "fstat(fd=%d): %s", pe->fd, strerror(errno));
+                return pe->cache_size;
+        }
+
+        /* what the file really uses on disk, holes excluded */
+        return st.st_blocks * 512;
+}
+
+void
+lru_touch(tpath_entry *pe)
+{
+        off_t size;
+
+        assert(pe);
+
+        /* not admitted, it will be dropped on release */
+        if (pe->transient)
+                return;
+
+        size = lru_file_size(pe);
+
+        pthread_mutex_lock(&lru_mutex);
+
+        pe->lru_time = pe->last_access = time(NULL);
+
+        if (pe->lru_link) {
+                g_queue_unlink(&lru, pe->lru_link);
+                g_queue_push_head_link(&lru, pe->lru_link);
+        } else {
+                g_queue_push_head(&lru, pe);
+                pe->lru_link = g_queue_peek_head_link(&lru);
+        }
+
+        lru_bytes -= pe->cache_size;
+        lru_bytes += size;
+        pe->cache_size = size;
+
+        pthread_mutex_unlock(&lru_mutex);
+
+        if (conf->max_open_files &&
+            g_atomic_int_get(&lru_fds) > conf->max_open_files)
+                lru_park();
+
+        if (lru_over_hiwat())
+                (void)lru_evict();
+}
+
+void
+lru_grow(tpath_entry *pe,
+         off_t delta)
+{
+        assert(pe);
+
+        pthread_mutex_lock(&lru_mutex);
+
+        if (pe->lru_link) {
+                pe->cache_size += delta;
+                lru_bytes += delta;
+        }
+
+        pthread_mutex_unlock(&lru_mutex);
+
+        if (lru_over_hiwat())
+                (void)lru_evict();
+}
+
+void
+lru_remove(tpath_entry *pe)
+{
+        assert(pe);
+
+        pthread_mutex_lock(&lru_mutex);
+
+        if (pe->lru_link) {
+                g_queue_delete_link(&lru, pe->lru_link);
+                pe->lru_link = NULL;
+                lru_bytes -= pe->cache_size;
+                pe->cache_size = 0;
+        }
+
+        pthread_mutex_unlock(&lru_mutex);
+}
+
+static int
+lru_evictable(tpath_entry *pe)
+{
+        if (pentry_get_refcount(pe))
+                return 0;
+
+        /* not uploaded yet, or never uploaded at all */
+        if (FLAG_DIRTY == pe->flag || pe->exclude)
+                return 0;
+
+        if (pin_match(pe->path))
+                return 0;
+
+        return 1;
+}
+
+static void
+lru_unlink_cache_file(tpath_entry *pe)
+{
+        pentry_unlink_cache_file(pe);
+        ram_drop(pe);
+        lru_set_fd(pe, -1);
+        block_map_free(pe->blocks);
+        pe->blocks = NULL;
+
+        pentry_md_lock(pe);
+        pe->ondisk = pe->usermd ? FILE_REMOTE : FILE_UNSET;
+        pentry_md_unlock(pe);
+}
+
+/* called with lru_mutex held */
+static unsigned long long
+lru_drop(tpath_entry *pe)
+{
+        unsigned long long size;
+
+        if (! lru_evictable(pe))
+                return 0;
+
+        if (pentry_trylock(pe))
+                return 0;
+
+        LOG(LOG_INFO, "evict cache file of '%s' (%llu bytes)",
+            pe->path, (unsigned long long)pe->cache_size);
+
+        lru_unlink_cache_file(pe);
+
+        size = pe->cache_size;
+        g_queue_delete_link(&lru, pe->lru_link);
+        pe->lru_link = NULL;
+        lru_bytes -= pe->cache_size;
+        pe->cache_size = 0;
+
+        pentry_unlock(pe);
+
+        return size;
+}
+
+/* called with lru_mutex held: punch holes in the sparse cache files, in
+ * the blocks not read since `before' */
+static unsigned long long
+lru_punch(time_t before,
+          unsigned long long need)
+{
+        GList *link = NULL;
+        tpath_entry *pe = NULL;
+        unsigned long long freed = 0;
+        off_t punched;
+
+        for (link = g_queue_peek_tail_link(&lru); link && freed < need;
+             link = link->prev) {
+                pe = link->data;
+                if (! pe->blocks)
+                        continue;
+
+                punched = block_punch(pe, before, need - freed);
+                pe->cache_size -= punched;
+                lru_bytes -= punched;
+                freed += punched;
+        }
+
+        return freed;
+}
+
+static unsigned long long
+lru_release(unsigned long long need)
+{
+        GList *link = NULL;
+        GList *prev = NULL;
+        tpath_entry *coldest = NULL;
+        unsigned long long freed = 0;
+
+        pthread_mutex_lock(&lru_mutex);
+
+        /* first the blocks colder than the coldest whole file */
+        coldest = g_queue_peek_tail(&lru);
+        if (coldest)
+                freed += lru_punch(coldest->lru_time, need);
+
+        for (link = g_queue_peek_tail_link(&lru); link && freed < need; link = prev) {
+                prev = link->prev;
+                freed += lru_drop(link->data);
+        }
+
+        /* then whatever is not being read right now, even in open files */
+        if (freed < need)
+                freed += lru_punch(time(NULL), need - freed);
+
+        pthread_mutex_unlock(&lru_mutex);
+
+        return freed;
+}
+
+unsigned long long
+lru_evict(void)
+{
+        unsigned long long need;
+        unsigned long long freed = 0;
+
+        /* one eviction at a time is enough */
+        if (pthread_mutex_trylock(&evict_mutex))
+                return 0;
+
+        need = lru_bytes_to_free();
+        if (need) {
+                freed = lru_release(need);
+                LOG(LOG_NOTICE, "disk cache: %llu bytes needed, %llu released,"
+                    " %llu bytes in use", need, freed, lru_bytes);
+                if (freed < need)
+                        LOG(LOG_WARNING, "disk cache: %llu bytes pinned",
+                            lru_get_pinned_bytes());
+        }
+
+        pthread_mutex_unlock(&evict_mutex);
+
+        return freed;
+}
+
+unsigned long long
+lru_reclaim(unsigned long long need)
+{
+        unsigned long long freed;
+
+        pthread_mutex_lock(&evict_mutex);
+        freed = lru_release(need);
+        pthread_mutex_unlock(&evict_mutex);
+
+        LOG(LOG_NOTICE, "disk cache: reclaimed %llu of %llu bytes", freed, need);
+
+        return freed;
+}
+
+/* TinyLFU: a new file only enters a full cache if it has been accessed more
+ * often than the file it would push out, so that a scan over the whole
+ * mount does not flush the working set */
+int
+lru_admit(tpath_entry *pe,
+          off_t size)
+{
+        GList *link = NULL;
+        tpath_entry *victim = NULL;
+        int scanned = 0;
+        int admit = 1;
+
+        assert(pe);
+
+        if (! conf->disk_cache_size)
+                return 1;
+
+        if (pin_match(pe->path))
+                return 1;
+
+        if (lru_bytes + size <= conf->disk_cache_size / 100 * LRU_HIWAT)
+                return 1;
+
+        pthread_mutex_lock(&lru_mutex);
+
+        for (link = g_queue_peek_tail_link(&lru);
+             link && scanned < LRU_VICTIM_SCAN;
+             link = link->prev, scanned++) {
+                if (lru_evictable(link->data)) {
+                        victim = link->data;
+                        break;
+                }
+        }
+
+        if (victim)
+                admit = sketch_estimate(pe->path) >
+                        sketch_estimate(victim->path);
+
+        pthread_mutex_unlock(&lru_mutex);
+
+        LOG(LOG_DEBUG, "%s: %s (victim=%s)", pe->path,
+            admit ? "admitted" : "rejected", victim ? victim->path : "none");
+
+        return admit;
+}
+
+void
+lru_forget(tpath_entry *pe)
+{
+        assert(pe);
+
+        /* still open, its last release will come back here */
+        if (pentry_get_refcount(pe))
+                return;
+
+        /* to be uploaded, pinned, or busy: it can't go now, track it like
+         * any other cache file so that eviction and expiry see it */
+        if (FLAG_DIRTY == pe->flag || pin_match(pe->path) ||
+            pentry_trylock(pe)) {
+                pe->transient = 0;
+                lru_touch(pe);
+                return;
+        }
+
+        LOG(LOG_INFO, "drop cache file of '%s', not admitted", pe->path);
+
+        lru_unlink_cache_file(pe);
+        pe->transient = 0;
+
+        pentry_unlock(pe);
+}
+
+/* called with lru_mutex held; put an entry off the list back in its
+ * place for its lru_time, behind the newer ones, so that the list stays
+ * ordered by lru_time */
+static void
+lru_insert(tpath_entry *pe)
+{
+        GList *sibling = NULL;
+
+        for (sibling = g_queue_peek_head_link(&lru);
+             sibling && ((tpath_entry *)sibling->data)->lru_time > pe->lru_time;
+             sibling = sibling->next)
+                ;
+
+        if (sibling) {
+                g_queue_insert_before(&lru, sibling, pe);
+                pe->lru_link = sibling->prev;
+        } else {
+                g_queue_push_tail(&lru, pe);
+                pe->lru_link = g_queue_peek_tail_link(&lru);
+        }
+}
+
+/* called with lru_mutex held; take an entry off the list until the end of
+ * the walk, so that it is not visited twice */
+static void
+lru_keep(GQueue *kept,
+         tpath_entry *pe,
+         time_t when)
+{
+        g_queue_delete_link(&lru, pe->lru_link);
+        pe->lru_link = NULL;
+        pe->lru_time = when;
+        g_queue_push_tail(kept, pe);
+}
+
+/* Remove an expired entry from the hashtable, unless it was opened or
+ * written since it left the list: then it goes back to the list. */
+static void
+lru_expire_entry(GHashTable *hash,
+                 tpath_entry *pe)
+{
+        gpointer key = NULL;
+
+        if (pentry_trylock(pe)) {
+                lru_touch(pe);
+                return;
+        }
+
+        /* touched meanwhile, it is back on the list */
+        pthread_mutex_lock(&lru_mutex);
+        if (pe->lru_link) {
+                pthread_mutex_unlock(&lru_mutex);
+                pentry_unlock(pe);
+                return;
+        }
+
+        if (pentry_get_refcount(pe) || FLAG_DIRTY == pe->flag ||
+            ! g_hash_table_lookup_extended(hash, pe->path, &key, NULL)) {
+                pthread_mutex_unlock(&lru_mutex);
+                pentry_unlock(pe);
+                lru_touch(pe);
+                return;
+        }
+
+        LOG(LOG_DEBUG, "%s file too old, last access=%d",
+            pe->path, (int)pe->last_access);
+
+        /* out of the table before the locks go, no lookup finds it now */
+        LOG(LOG_DEBUG, "path=%s remove from the hashtable", pe->path);
+        g_hash_table_steal(hash, pe->path);
+
+        pthread_mutex_unlock(&lru_mutex);
+
+        pentry_unlink_cache_file(pe);
+        pentry_unlock(pe);
+
+        pentry_free(pe);
+        free(key);
+}
+
+/* The recency list is ordered by lru_time, and last_access is never older
+ * than lru_time, so we can stop at the first entry which is neither due
+ * nor accessed since it was moved. Entries read or written since get a
+ * second chance, in their place for their last access time; entries due
+ * but in use start over. Both are put back once the walk is over. */
+void
+lru_expire(GHashTable *hash)
+{
+        GList *link = NULL;
+        GList *prev = NULL;
+        GQueue expired = G_QUEUE_INIT;
+        GQueue kept = G_QUEUE_INIT;
+        tpath_entry *pe = NULL;
+        time_t now;
+        int threshold;
+        int visited = 0;
+
+        now = time(NULL);
+
+        pthread_mutex_lock(&lru_mutex);
+
+        for (link = g_queue_peek_tail_link(&lru); link; link = prev) {
+                prev = link->prev;
+                pe = link->data;
+                visited++;
+
+                threshold = conf->gc_age_threshold;
+                if (pe->exclude)
+                        threshold *= 10;
+
+                if (now < pe->last_access + threshold) {
+                        if (pe->last_access > pe->lru_time) {
+                                lru_keep(&kept, pe, pe->last_access);
+                                continue;
+                        }
+                        if (pe->exclude)
+                                continue;
+                        break;
+                }
+
+                /* due, but open, not uploaded yet, or pinned */
+                if (pentry_get_refcount(pe) || FLAG_DIRTY == pe->flag ||
+                    pin_match(pe->path)) {
+                        lru_keep(&kept, pe, now);
+                        continue;
+                }
+
+                g_queue_delete_link(&lru, pe->lru_link);
+                pe->lru_link = NULL;
+                lru_bytes -= pe->cache_size;
+                pe->cache_size = 0;
+
+                g_queue_push_tail(&expired, pe);
+        }
+
+        while ((pe = g_queue_pop_head(&kept)))
+                lru_insert(pe);
+
+        pthread_mutex_unlock(&lru_mutex);
+
+        LOG(LOG_DEBUG, "%d entries visited, %u expired",
+            visited, g_queue_get_length(&expired));
+
+        while ((pe = g_queue_pop_head(&expired)))
+                lru_expire_entry(hash, pe);
+}
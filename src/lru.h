@@ -0,0 +1,40 @@
+#ifndef LRU_H
+#define LRU_H
+
+#include "hash.h"
+
+/* move the entry at the head of the recency list, account its cache file
+ * size and make room if the disk cache is over its high watermark */
+void lru_touch(tpath_entry *);
+void lru_remove(tpath_entry *);
+
+/* is this freshly downloaded file worth more than the next eviction
+ * victim? return 1 if it is, 0 if it should be dropped after use */
+int lru_admit(tpath_entry *, off_t);
+/* remove the cache file of an entry which was not admitted */
+void lru_forget(tpath_entry *);
+
+/* drop the coldest unreferenced cache files until both the byte budget
+ * and the free space of the cache filesystem are fine, return the number
+ * of bytes released */
+unsigned long long lru_evict(void);
+
+/* free at least this amount of bytes, whatever the watermarks */
+unsigned long long lru_reclaim(unsigned long long);
+
+/* remove the cache files, and the hashtable cells, of the entries not
+ * accessed for gc_age_threshold seconds; only the due entries are visited */
+void lru_expire(GHashTable *);
+
+/* replace the cache file descriptor of an entry, closing the previous one,
+ * so that the number of open cache files is known */
+void lru_set_fd(tpath_entry *, int);
+
+/* account bytes added to the cache file of an entry */
+void lru_grow(tpath_entry *, off_t);
+
+unsigned long long lru_get_bytes(void);
+/* the part of lru_get_bytes() which can't be evicted */
+unsigned long long lru_get_pinned_bytes(void);
+
+#endif /* LRU_H */
@@ -1,13 +1,19 @@
 #include <errno.h>
 #include <glib.h>
-#include <libgen.h>
 
 #include "open.h"
-#include "misc.h"
 #include "log.h"
 #include "glob.h"
 #include "file.h"
 #include "tmpstr.h"
+#include "lru.h"
+#include "block.h"
+#include "ram.h"
+#include "local.h"
+#include "sketch.h"
+#include "breaker.h"
+#include "timeout.h"
+#include "delete.h"
 
 extern GHashTable *hash;
 extern struct conf *conf;
@@ -27,42 +33,6 @@ static int open_flags[] = {
         [MODE_CREAT]  = O_RDWR|O_CREAT|O_TRUNC,
 };
 
-static char *
-build_cache_tree(const char *path)
-{
-        LOG(LOG_DEBUG, "building cache dir for '%s'", path);
-
-        char *local = NULL;
-        char *tmp_local = NULL;
-        char *dir = NULL;
-        struct stat st;
-
-        /* ignore the leading spaces */
-        while (path && '/' == *path)
-                path++;
-
-        local = tmpstr_printf("%s/%s", conf->cache_dir, path);
-
-        tmp_local = strdup(local);
-
-        if (! tmp_local) {
-                LOG(LOG_CRIT, "strdup(%s): %s", tmp_local, strerror(errno));
-                return NULL;
-        }
-
-        dir = tmpstr_printf("%s", dirname(tmp_local));
-        if (-1 == stat(dir, &st)) {
-                if (ENOENT == errno)
-                        mkdir_tree(dir);
-                else
-                        LOG(LOG_ERR, "stat(%s): %s", dir, strerror(errno));
-        }
-
-        free(tmp_local);
-
-        return local;
-}
-
 static enum state_mode
 get_mode_from_flags(int flags)
 {
@@ -84,7 +54,7 @@ open_creat(const char * const path,
         int fd;
         char *local = NULL;
 
-        local = build_cache_tree(path);
+        local = local_prepare(path);
 
         if (! local) {
                 LOG(LOG_ERR, "can't create a cache local path (%s)", path);
@@ -100,8 +70,10 @@ open_creat(const char * const path,
                 ret = -1;
                 goto err;
         }
-        pe->fd = fd;
+        lru_set_fd(pe, fd);
+        ram_drop(pe);
         pe->flag = FLAG_DIRTY;
+        pe->keep_cache = 0;
 
         ret = 0;
   err:
@@ -114,19 +86,65 @@ open_existing(const char * const path,
               int flags)
 {
         int ret;
+        int fd;
+        char *local = NULL;
+        int stale_ok;
+
+        /* the store is out of reach: a stale copy is better than none for
+         * a reader, it is checked again once the store is back */
+        stale_ok = FLAG_STALE == pe->flag &&
+                O_RDONLY == (flags & O_ACCMODE) && breaker_open();
+
+        /* a prefetch worker or another opener may be downloading it, wait
+         * for them and check again what is on disk */
+        pentry_lock(pe);
+
+        /* the cache file is there but its descriptor was closed to stay
+         * under max_open_files, just reopen it */
+        if (pe->fd < 0 && FILE_LOCAL == pe->ondisk &&
+            (FLAG_CLEAN == pe->flag || stale_ok)) {
+                local = pentry_cache_path(pe);
+                fd = open(local, pe->blocks ? O_RDWR : flags);
+                if (-1 != fd) {
+                        lru_set_fd(pe, fd);
+                        ret = 0;
+                        goto err;
+                }
+                LOG(LOG_NOTICE, "%s: %s, download it again",
+                    local, strerror(errno));
+        }
 
-        /* negative fd? then we don't have any cache file, get it! */
-        if (pe->fd < 0) {
-                (void) build_cache_tree(path);
-                pe->fd = dfs_get_local_copy(pe, path, flags);
-                if (-1 == pe->fd) {
+        /* other handles read and write through the current descriptor
+         * without the entry lock, it can't be replaced under them: this
+         * opener shares their copy, it is checked again once they are
+         * all closed */
+        if (pe->fd >= 0 && FLAG_STALE == pe->flag && ! stale_ok &&
+            pentry_get_refcount(pe) > 1) {
+                LOG(LOG_NOTICE, "%s: stale but in use, not downloaded again",
+                    path);
+                ret = 0;
+                goto err;
+        }
+
+        /* negative fd? then we don't have any cache file, get it! A stale
+         * entry has to be checked against the remote digest too */
+        if (pe->fd < 0 || (FLAG_STALE == pe->flag && ! stale_ok)) {
+                (void) local_prepare(path);
+                fd = dfs_get_local_copy(pe, path, flags);
+                if (-1 == fd && ! pe->stream) {
                         ret = -1;
                         goto err;
                 }
+
+                lru_set_fd(pe, fd);
+                if (FLAG_STALE == pe->flag)
+                        pe->flag = FLAG_CLEAN;
         }
 
         ret = 0;
   err:
+        pentry_unlock(pe);
+
         return ret;
 }
 
@@ -146,8 +164,23 @@ open_wronly(const char * const path,
         int ret;
 
         ret = open_existing(path, pe, flags);
-        if (0 == ret)
+
+        /* no room left in the cache, we can't write anything */
+        if (0 == ret && pe->stream) {
+                LOG(LOG_ERR, "%s: no cache file to write to", path);
+                ret = -1;
+        }
+
+        /* the whole file will be uploaded on release, get it all */
+        if (0 == ret && pe->blocks && block_fill(pe) < 0) {
+                LOG(LOG_ERR, "%s: can't fetch the missing blocks", path);
+                ret = -1;
+        }
+
+        if (0 == ret) {
                 pe->flag = FLAG_DIRTY;
+                ram_drop(pe);
+        }
 
         return ret;
 }
@@ -172,6 +205,12 @@ dfs_open(const char *path,
         LOG(LOG_DEBUG, "path=%s %s 0%o",
             path, flags_to_str(info->flags), info->flags);
 
+        /* removed, the store may not know it yet */
+        if (delete_pending(path)) {
+                ret = -ENOENT;
+                goto err;
+        }
+
         pe = g_hash_table_lookup(hash, path);
         if (! pe) {
                 LOG(LOG_INFO, "'%s': entry not found in hashtable", path);
@@ -191,6 +230,7 @@ dfs_open(const char *path,
 
         info->fh = (uint64_t)pe;
         pentry_inc_refcount(pe);
+        sketch_increment(path);
 
         smode = get_mode_from_flags(info->flags);
 
@@ -204,15 +244,35 @@ dfs_open(const char *path,
                 [MODE_CREAT]  = open_creat,
         };
 
+        /* no release will follow a failed open */
         if (-1 == fn[smode](path, pe, open_flags[smode])) {
+                pentry_dec_refcount(pe);
+                info->fh = 0;
                 ret = -1;
                 goto err;
         }
 
-        pe->ondisk = FILE_LOCAL;
+        if (pe->stream) {
+                pe->ondisk = FILE_REMOTE;
+        } else {
+                pe->ondisk = FILE_LOCAL;
+                lru_touch(pe);
+                if (MODE_RDONLY == smode)
+                        ram_promote(pe);
+        }
+
+        /* let the kernel keep its page cache unless the content changed
+         * since the last open */
+        info->keep_cache = pe->keep_cache;
+        pe->keep_cache = 1;
+
         ret = 0;
   err:
+        /* the application gave up on it, say so rather than fail */
+        if (ret && dfs_interrupted())
+                ret = -EINTR;
+
         LOG(LOG_DEBUG, "@pentry=%p, fd=%d, flags=0x%X, ret=%d",
-            pe, pe->fd, info->flags, ret);
+            pe, pe ? pe->fd : -1, info->flags, ret);
         return ret;
 }
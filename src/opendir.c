@@ -28,6 +28,20 @@ dfs_opendir(const char *path,
                 goto err;
         }
 
+        /* readdir only gets this handle (flag_nopath) */
+        pe = g_hash_table_lookup(hash, path);
+        if (! pe) {
+                if (-1 == populate_hash(hash, path, FILE_DIR, &pe)) {
+                        LOG(LOG_ERR, "populate with path %s failed", path);
+                        ret = -1;
+                        goto err;
+                }
+        }
+
+        /* held until releasedir, so the entry outlives a rename */
+        info->fh = (uint64_t)pe;
+        pentry_inc_refcount(pe);
+
         ret = 0;
   err:
 
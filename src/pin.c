@@ -0,0 +1,232 @@
+#include <errno.h>
+#include <glib.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "pin.h"
+#include "getattr.h"
+#include "log.h"
+#include "prefetch.h"
+#include "tmpstr.h"
+
+extern struct conf *conf;
+
+/* pinned path -> GINT_TO_POINTER(1 if it is a directory, 2 otherwise) */
+static GHashTable *pins = NULL;
+static pthread_mutex_t pin_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+#define PIN_DIR 1
+#define PIN_FILE 2
+
+static char *
+pin_file(void)
+{
+        return tmpstr_printf("%s.pins", conf->cache_dir);
+}
+
+static void
+cb_pin_save(gpointer key,
+            gpointer value,
+            gpointer user_data)
+{
+        fprintf(user_data, "%c %s\n",
+                PIN_DIR == GPOINTER_TO_INT(value) ? 'd' : 'f', (char *)key);
+}
+
+/* called with pin_mutex held */
+static int
+pin_save(void)
+{
+        FILE *fp = NULL;
+        char *file = NULL;
+        char *tmp = NULL;
+
+        file = pin_file();
+        tmp = tmpstr_printf("%s.tmp", file);
+
+        fp = fopen(tmp, "w");
+        if (! fp) {
+                LOG(LOG_ERR, "fopen(%s): %s", tmp, strerror(errno));
+                return -1;
+        }
+
+        g_hash_table_foreach(pins, cb_pin_save, fp);
+
+        if (fclose(fp)) {
+                LOG(LOG_ERR, "fclose(%s): %s", tmp, strerror(errno));
+                return -1;
+        }
+
+        if (-1 == rename(tmp, file)) {
+                LOG(LOG_ERR, "rename(%s, %s): %s", tmp, file, strerror(errno));
+                return -1;
+        }
+
+        return 0;
+}
+
+/* called with pin_mutex held */
+static int
+pin_add(const char *path,
+        int type)
+{
+        char *key = NULL;
+
+        if (! pins)
+                pins = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                             free, NULL);
+
+        key = strdup(path);
+        if (! key) {
+                LOG(LOG_ERR, "strdup(%s): %s", path, strerror(errno));
+                return -1;
+        }
+
+        g_hash_table_replace(pins, key, GINT_TO_POINTER(type));
+
+        return 0;
+}
+
+static void
+pin_prefetch(const char *path,
+             int type)
+{
+        if (PIN_DIR == type)
+                prefetch_push_tree(path);
+        else
+                prefetch_push(path);
+}
+
+int
+pin_set(const char *path,
+        int on)
+{
+        struct stat st;
+        int type;
+        int ret;
+
+        if (! on) {
+                pthread_mutex_lock(&pin_mutex);
+                if (pins && g_hash_table_remove(pins, path))
+                        (void)pin_save();
+                pthread_mutex_unlock(&pin_mutex);
+
+                if (pin_match(path))
+                        LOG(LOG_NOTICE, "%s: still pinned by a parent", path);
+
+                return 0;
+        }
+
+        ret = dfs_getattr(path, &st);
+        if (ret)
+                return ret;
+
+        if (S_ISDIR(st.st_mode))
+                type = PIN_DIR;
+        else if (S_ISREG(st.st_mode))
+                type = PIN_FILE;
+        else
+                return -EINVAL;
+
+        pthread_mutex_lock(&pin_mutex);
+        ret = pin_add(path, type);
+        if (0 == ret)
+                (void)pin_save();
+        pthread_mutex_unlock(&pin_mutex);
+
+        if (ret)
+                return -ENOMEM;
+
+        LOG(LOG_INFO, "%s: pinned", path);
+        pin_prefetch(path, type);
+
+        return 0;
+}
+
+int
+pin_match(const char *path)
+{
+        char *tmp = NULL;
+        char *slash = NULL;
+        int ret = 0;
+
+        pthread_mutex_lock(&pin_mutex);
+
+        if (! pins || ! g_hash_table_size(pins))
+                goto end;
+
+        tmp = tmpstr_printf("%s", path);
+
+        /* "/a/b", then "/a", then "/" */
+        for (;;) {
+                if (g_hash_table_lookup(pins, tmp)) {
+                        ret = 1;
+                        break;
+                }
+
+                slash = strrchr(tmp, '/');
+                if (! slash || ! tmp[1])
+                        break;
+
+                if (slash == tmp)
+                        slash[1] = 0;
+                else
+                        *slash = 0;
+        }
+
+  end:
+        pthread_mutex_unlock(&pin_mutex);
+
+        return ret;
+}
+
+int
+pin_load(void)
+{
+        FILE *fp = NULL;
+        char *file = NULL;
+        char line[4096];
+        char *nl = NULL;
+        int type;
+        int loaded = 0;
+
+        file = pin_file();
+        fp = fopen(file, "r");
+        if (! fp) {
+                if (ENOENT == errno)
+                        return 0;
+                LOG(LOG_ERR, "fopen(%s): %s", file, strerror(errno));
+                return -1;
+        }
+
+        while (fgets(line, sizeof line, fp)) {
+                nl = strchr(line, '\n');
+                if (! nl)
+                        continue;
+                *nl = 0;
+
+                if (strlen(line) < 3 || ' ' != line[1] || '/' != line[2])
+                        continue;
+
+                type = 'd' == line[0] ? PIN_DIR : PIN_FILE;
+
+                pthread_mutex_lock(&pin_mutex);
+                if (-1 == pin_add(line + 2, type)) {
+                        pthread_mutex_unlock(&pin_mutex);
+                        break;
+                }
+                pthread_mutex_unlock(&pin_mutex);
+
+                pin_prefetch(line + 2, type);
+                loaded++;
+        }
+
+        fclose(fp);
+
+        LOG(LOG_INFO, "%d pins loaded from %s", loaded, file);
+
+        return 0;
+}
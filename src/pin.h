@@ -0,0 +1,15 @@
+#ifndef PIN_H
+#define PIN_H
+
+/* Pinned files, and files under pinned directories, are prefetched and
+ * never evicted from the disk cache. The pins are saved next to the cache
+ * directory, and restored at mount. */
+
+int pin_set(const char *, int);
+
+/* 1 if the file, or one of its parent directories, is pinned */
+int pin_match(const char *);
+
+int pin_load(void);
+
+#endif /* PIN_H */
@@ -0,0 +1,452 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+
+#include "prefetch.h"
+#include "hash.h"
+#include "file.h"
+#include "log.h"
+#include "lru.h"
+#include "block.h"
+#include "local.h"
+#include "timeout.h"
+#include "throttle.h"
+#include "tmpstr.h"
+
+/* the prefetch workers yield to the threads serving the mount point */
+#define PREFETCH_NICE 10
+/* queued downloads per worker before a subtree walk waits */
+#define PREFETCH_BACKLOG 16
+
+extern GHashTable *hash;
+extern dpl_ctx_t *ctx;
+extern struct conf *conf;
+
+static GThreadPool *prefetch_pool = NULL;
+static __thread int prefetch_niced = 0;
+static int prefetch_stopping = 0;
+
+/* roots of the subtree walks -> struct prefetch_tree */
+static GHashTable *trees = NULL;
+static pthread_mutex_t tree_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+struct prefetch_tree {
+        char *root;
+        int refcount; /* the table, the walk, and each queued file */
+        int listing; /* the walk is not over */
+        unsigned int files_found;
+        unsigned int files_done;
+        unsigned int files_failed;
+        unsigned long long bytes_found;
+        unsigned long long bytes_done;
+};
+
+struct prefetch_job {
+        char *path;
+        unsigned long long size;
+        struct prefetch_tree *tree; /* or NULL */
+};
+
+/* a directory being listed, in the depth-first walk */
+struct walk_frame {
+        char *path;
+        void *dir_hdl;
+};
+
+/* fetch the blocks of a sparse cache file, without pinning them */
+static int
+prefetch_blocks(tpath_entry *pe)
+{
+        int ret;
+
+        ret = block_acquire(pe, 0, pe->blocks->size);
+        if (0 == ret)
+                block_release(pe);
+
+        return ret;
+}
+
+int
+prefetch_file(const char *path)
+{
+        tpath_entry *pe = NULL;
+        int fd;
+        int ret;
+
+        pe = g_hash_table_lookup(hash, path);
+        if (! pe && -1 == populate_hash(hash, path, FILE_REG, &pe)) {
+                LOG(LOG_ERR, "%s: can't add a new cell", path);
+                return -1;
+        }
+
+        if (FILE_REG != pe->filetype) {
+                LOG(LOG_INFO, "%s: not a regular file", path);
+                return -1;
+        }
+
+        pentry_inc_refcount(pe);
+
+        /* an opener may be downloading it, the check is only good once
+         * we hold the entry */
+        pentry_lock(pe);
+
+        /* already there, maybe with a parked descriptor */
+        if ((FILE_LOCAL == pe->ondisk || -1 != pe->fd) &&
+            FLAG_STALE != pe->flag) {
+                pentry_unlock(pe);
+                ret = 0;
+                goto sparse;
+        }
+
+        (void)local_prepare(path);
+        fd = dfs_get_local_copy(pe, path, O_RDONLY);
+        if (-1 == fd) {
+                pentry_unlock(pe);
+                LOG(LOG_NOTICE, "%s: prefetch failed", path);
+                ret = -1;
+                goto end;
+        }
+
+        lru_set_fd(pe, fd);
+        if (FLAG_STALE == pe->flag)
+                pe->flag = FLAG_CLEAN;
+        pe->ondisk = FILE_LOCAL;
+        pentry_unlock(pe);
+        lru_touch(pe);
+
+        ret = 0;
+  sparse:
+        if (pe->blocks && -1 != pe->fd && prefetch_blocks(pe) < 0)
+                ret = -1;
+  end:
+        pentry_dec_refcount(pe);
+
+        if (pe->transient)
+                lru_forget(pe);
+
+        LOG(LOG_DEBUG, "%s: ret=%d", path, ret);
+        return ret;
+}
+
+static void
+tree_unref(struct prefetch_tree *tree)
+{
+        int last;
+
+        pthread_mutex_lock(&tree_mutex);
+        last = ! --tree->refcount;
+        pthread_mutex_unlock(&tree_mutex);
+
+        if (last) {
+                free(tree->root);
+                free(tree);
+        }
+}
+
+static void
+cb_tree_free(gpointer data)
+{
+        struct prefetch_tree *tree = data;
+
+        /* called with tree_mutex held, by the table */
+        if (! --tree->refcount) {
+                free(tree->root);
+                free(tree);
+        }
+}
+
+static void
+prefetch_worker(gpointer data,
+                gpointer user_data)
+{
+        struct prefetch_job *job = data;
+        int ret;
+
+        (void)user_data;
+
+        if (! prefetch_niced) {
+                if (-1 == setpriority(PRIO_PROCESS, syscall(SYS_gettid),
+                                      PREFETCH_NICE))
+                        LOG(LOG_NOTICE, "setpriority: %s", strerror(errno));
+                throttle_set_class(THROTTLE_PREFETCH);
+                prefetch_niced = 1;
+        }
+
+        ret = prefetch_stopping ? -1 : prefetch_file(job->path);
+
+        if (job->tree) {
+                pthread_mutex_lock(&tree_mutex);
+                if (0 == ret) {
+                        job->tree->files_done++;
+                        job->tree->bytes_done += job->size;
+                } else {
+                        job->tree->files_failed++;
+                }
+                pthread_mutex_unlock(&tree_mutex);
+                tree_unref(job->tree);
+        }
+
+        free(job->path);
+        free(job);
+}
+
+int
+prefetch_init(void)
+{
+        GError *err = NULL;
+
+        if (! conf->prefetch_threads)
+                return 0;
+
+        trees = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                      NULL, cb_tree_free);
+
+        prefetch_pool = g_thread_pool_new(prefetch_worker, NULL,
+                                          conf->prefetch_threads, FALSE, &err);
+        if (err) {
+                LOG(LOG_ERR, "prefetch thread pool creation: %s", err->message);
+                prefetch_pool = NULL;
+                return -1;
+        }
+
+        return 0;
+}
+
+void
+prefetch_stop(void)
+{
+        if (! prefetch_pool)
+                return;
+
+        /* the walks stop queueing, the queued files are skipped */
+        prefetch_stopping = 1;
+        g_thread_pool_free(prefetch_pool, FALSE, TRUE);
+        prefetch_pool = NULL;
+}
+
+static int
+prefetch_queue(const char *path,
+               unsigned long long size,
+               struct prefetch_tree *tree)
+{
+        struct prefetch_job *job = NULL;
+
+        if (! prefetch_pool || prefetch_stopping)
+                return -1;
+
+        job = malloc(sizeof *job);
+        if (! job) {
+                LOG(LOG_ERR, "malloc: %s", strerror(errno));
+                return -1;
+        }
+
+        job->size = size;
+        job->tree = tree;
+        job->path = strdup(path);
+        if (! job->path) {
+                LOG(LOG_ERR, "strdup(%s): %s", path, strerror(errno));
+                free(job);
+                return -1;
+        }
+
+        if (tree) {
+                pthread_mutex_lock(&tree_mutex);
+                tree->refcount++;
+                tree->files_found++;
+                tree->bytes_found += size;
+                pthread_mutex_unlock(&tree_mutex);
+        }
+
+        g_thread_pool_push(prefetch_pool, job, NULL);
+
+        return 0;
+}
+
+void
+prefetch_push(const char *path)
+{
+        (void)prefetch_queue(path, 0, NULL);
+}
+
+static struct walk_frame *
+walk_frame_new(const char *path)
+{
+        struct walk_frame *frame = NULL;
+        dpl_status_t rc;
+
+        frame = malloc(sizeof *frame);
+        if (! frame) {
+                LOG(LOG_ERR, "malloc: %s", strerror(errno));
+                return NULL;
+        }
+
+        frame->path = strdup(path);
+        if (! frame->path) {
+                LOG(LOG_ERR, "strdup(%s): %s", path, strerror(errno));
+                free(frame);
+                return NULL;
+        }
+
+        rc = dfs_opendir_timeout(ctx, path, &frame->dir_hdl);
+        if (DPL_SUCCESS != rc) {
+                LOG(LOG_ERR, "%s: dfs_opendir_timeout: %s",
+                    path, dpl_status_str(rc));
+                free(frame->path);
+                free(frame);
+                return NULL;
+        }
+
+        return frame;
+}
+
+static void
+walk_frame_free(struct walk_frame *frame)
+{
+        dpl_closedir(frame->dir_hdl);
+        free(frame->path);
+        free(frame);
+}
+
+/* Depth-first: only the directories from the root to the current one are
+ * open, and the walk waits for the workers when enough files are queued,
+ * so the memory does not grow with the size of the subtree. */
+static void *
+prefetch_walk(void *arg)
+{
+        struct prefetch_tree *tree = arg;
+        GQueue stack = G_QUEUE_INIT;
+        struct walk_frame *frame = NULL;
+        dpl_dirent_t dirent;
+        char *child = NULL;
+
+        LOG(LOG_INFO, "%s: walking the subtree", tree->root);
+
+        throttle_set_class(THROTTLE_PREFETCH);
+
+        frame = walk_frame_new(tree->root);
+        if (frame)
+                g_queue_push_head(&stack, frame);
+
+        while ((frame = g_queue_peek_head(&stack))) {
+                if (prefetch_stopping ||
+                    DPL_SUCCESS != dpl_readdir(frame->dir_hdl, &dirent)) {
+                        walk_frame_free(g_queue_pop_head(&stack));
+                        continue;
+                }
+
+                if (! strcmp(dirent.name, ".") || ! strcmp(dirent.name, ".."))
+                        continue;
+
+                child = tmpstr_printf("%s/%s",
+                                      strcmp(frame->path, "/") ? frame->path : "",
+                                      dirent.name);
+
+                if (DPL_FTYPE_DIR == dirent.type) {
+                        frame = walk_frame_new(child);
+                        if (frame)
+                                g_queue_push_head(&stack, frame);
+                        continue;
+                }
+
+                if (DPL_FTYPE_REG != dirent.type)
+                        continue;
+
+                while (! prefetch_stopping && prefetch_pool &&
+                       g_thread_pool_unprocessed(prefetch_pool) >=
+                       PREFETCH_BACKLOG * conf->prefetch_threads)
+                        usleep(10 * 1000); /* 10ms */
+
+                (void)prefetch_queue(child, dirent.size, tree);
+        }
+
+        pthread_mutex_lock(&tree_mutex);
+        tree->listing = 0;
+        pthread_mutex_unlock(&tree_mutex);
+
+        LOG(LOG_INFO, "%s: %u files, %llu bytes found", tree->root,
+            tree->files_found, tree->bytes_found);
+
+        tree_unref(tree);
+
+        return NULL;
+}
+
+int
+prefetch_push_tree(const char *path)
+{
+        struct prefetch_tree *tree = NULL;
+        pthread_t id;
+        pthread_attr_t attr;
+        int ret;
+
+        if (! prefetch_pool)
+                return -ENOTSUP;
+
+        tree = calloc(1, sizeof *tree);
+        if (! tree) {
+                LOG(LOG_ERR, "calloc: %s", strerror(errno));
+                return -ENOMEM;
+        }
+
+        tree->root = strdup(path);
+        if (! tree->root) {
+                LOG(LOG_ERR, "strdup(%s): %s", path, strerror(errno));
+                free(tree);
+                return -ENOMEM;
+        }
+
+        tree->listing = 1;
+        tree->refcount = 2; /* the table and the walk */
+
+        pthread_mutex_lock(&tree_mutex);
+        g_hash_table_replace(trees, tree->root, tree);
+        pthread_mutex_unlock(&tree_mutex);
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        ret = pthread_create(&id, &attr, prefetch_walk, tree);
+        pthread_attr_destroy(&attr);
+
+        if (ret) {
+                LOG(LOG_ERR, "pthread_create: %s", strerror(ret));
+                pthread_mutex_lock(&tree_mutex);
+                tree->listing = 0;
+                pthread_mutex_unlock(&tree_mutex);
+                tree_unref(tree);
+                return -ret;
+        }
+
+        return 0;
+}
+
+char *
+prefetch_progress(const char *path)
+{
+        struct prefetch_tree *tree = NULL;
+        char *progress = NULL;
+
+        pthread_mutex_lock(&tree_mutex);
+
+        if (trees)
+                tree = g_hash_table_lookup(trees, path);
+
+        if (tree)
+                progress = tmpstr_printf(
+                        "files=%u/%u failed=%u bytes=%llu/%llu remaining=%llu %s",
+                        tree->files_done, tree->files_found, tree->files_failed,
+                        tree->bytes_done, tree->bytes_found,
+                        tree->bytes_found - tree->bytes_done,
+                        tree->listing ? "listing" :
+                        tree->files_done + tree->files_failed <
+                        tree->files_found ? "running" : "done");
+
+        pthread_mutex_unlock(&tree_mutex);
+
+        return progress;
+}
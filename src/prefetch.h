@@ -0,0 +1,20 @@
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+/* background downloads, by prefetch_threads low priority workers */
+int prefetch_init(void);
+void prefetch_stop(void);
+
+/* queue a remote file to be brought in the cache */
+void prefetch_push(const char *);
+/* same for every file under a remote directory, return 0 or -errno */
+int prefetch_push_tree(const char *);
+
+/* where the last walk of this directory is, in a temporary string, or
+ * NULL if there was none */
+char *prefetch_progress(const char *);
+
+/* bring a remote file in the cache, now; return 0 on success */
+int prefetch_file(const char *);
+
+#endif /* PREFETCH_H */
@@ -0,0 +1,190 @@
+#include <assert.h>
+#include <errno.h>
+#include <glib.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "ram.h"
+#include "hash.h"
+#include "log.h"
+#include "sketch.h"
+
+/* opened at least this number of times recently to deserve memory */
+#define RAM_MIN_HITS 2
+
+extern struct conf *conf;
+
+struct ram_copy {
+        tpath_entry *pe;
+        GList *link; /* position in the memory recency list */
+        int users; /* readers copying from data right now */
+        int detached; /* evicted while in use, the last user frees it */
+        size_t size;
+        char data[];
+};
+
+static GQueue ram = G_QUEUE_INIT;
+static pthread_mutex_t ram_mutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long ram_bytes = 0;
+
+unsigned long long
+ram_get_bytes(void)
+{
+        return ram_bytes;
+}
+
+/* called with ram_mutex held */
+static void
+ram_detach(struct ram_copy *copy)
+{
+        g_queue_delete_link(&ram, copy->link);
+        copy->link = NULL;
+        copy->pe->ram = NULL;
+        ram_bytes -= copy->size;
+
+        if (copy->users)
+                copy->detached = 1;
+        else
+                free(copy);
+}
+
+/* called with ram_mutex held */
+static void
+ram_evict(size_t room)
+{
+        struct ram_copy *copy = NULL;
+
+        while (ram_bytes + room > conf->ram_cache_size) {
+                copy = g_queue_peek_tail(&ram);
+                if (! copy)
+                        break;
+
+                LOG(LOG_DEBUG, "%s: evicted from memory", copy->pe->path);
+                ram_detach(copy);
+        }
+}
+
+void
+ram_promote(tpath_entry *pe)
+{
+        struct ram_copy *copy = NULL;
+        struct stat st;
+        ssize_t len;
+
+        assert(pe);
+
+        if (! conf->ram_cache_size || pe->ram)
+                return;
+
+        /* sparse, streamed or being written, the disk has the truth */
+        if (pe->stream || pe->blocks || pe->fd < 0 || FLAG_CLEAN != pe->flag)
+                return;
+
+        if (sketch_estimate(pe->path) < RAM_MIN_HITS)
+                return;
+
+        if (-1 == fstat(pe->fd, &st)) {
+                LOG(LOG_ERR, "fstat(fd=%d): %s", pe->fd, strerror(errno));
+                return;
+        }
+
+        if (st.st_size > conf->ram_cache_max_file)
+                return;
+
+        copy = malloc(sizeof *copy + st.st_size);
+        if (! copy) {
+                LOG(LOG_ERR, "malloc: %s", strerror(errno));
+                return;
+        }
+
+        len = pread(pe->fd, copy->data, st.st_size, 0);
+        if (len != st.st_size) {
+                LOG(LOG_ERR, "%s: pread(fd=%d): %s", pe->path, pe->fd,
+                    -1 == len ? strerror(errno) : "short read");
+                free(copy);
+                return;
+        }
+
+        copy->pe = pe;
+        copy->users = 0;
+        copy->detached = 0;
+        copy->size = len;
+
+        pthread_mutex_lock(&ram_mutex);
+
+        /* someone was faster */
+        if (pe->ram) {
+                pthread_mutex_unlock(&ram_mutex);
+                free(copy);
+                return;
+        }
+
+        ram_evict(copy->size);
+        g_queue_push_head(&ram, copy);
+        copy->link = g_queue_peek_head_link(&ram);
+        pe->ram = copy;
+        ram_bytes += copy->size;
+
+        pthread_mutex_unlock(&ram_mutex);
+
+        LOG(LOG_DEBUG, "%s: %zu bytes loaded in memory", pe->path, copy->size);
+}
+
+int
+ram_read(tpath_entry *pe,
+         char *buf,
+         size_t size,
+         off_t offset)
+{
+        struct ram_copy *copy = NULL;
+        int ret;
+
+        assert(pe);
+
+        pthread_mutex_lock(&ram_mutex);
+
+        copy = pe->ram;
+        if (! copy) {
+                pthread_mutex_unlock(&ram_mutex);
+                return -1;
+        }
+
+        copy->users++;
+        g_queue_unlink(&ram, copy->link);
+        g_queue_push_head_link(&ram, copy->link);
+
+        pthread_mutex_unlock(&ram_mutex);
+
+        if (offset >= copy->size) {
+                ret = 0;
+        } else {
+                if (offset + size > copy->size)
+                        size = copy->size - offset;
+                memcpy(buf, copy->data + offset, size);
+                ret = size;
+        }
+
+        pthread_mutex_lock(&ram_mutex);
+        copy->users--;
+        if (copy->detached && ! copy->users)
+                free(copy);
+        pthread_mutex_unlock(&ram_mutex);
+
+        return ret;
+}
+
+void
+ram_drop(tpath_entry *pe)
+{
+        assert(pe);
+
+        pthread_mutex_lock(&ram_mutex);
+
+        if (pe->ram)
+                ram_detach(pe->ram);
+
+        pthread_mutex_unlock(&ram_mutex);
+}
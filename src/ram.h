@@ -0,0 +1,22 @@
+#ifndef RAM_H
+#define RAM_H
+
+#include <sys/types.h>
+
+#include "hash.h"
+
+/* memory tier, on top of the disk cache: the content of small and often
+ * read files, up to ram_cache_size bytes */
+
+/* load the cache file in memory if the file is small and popular enough */
+void ram_promote(tpath_entry *);
+
+/* copy from the memory copy, return -1 if there is none */
+int ram_read(tpath_entry *, char *, size_t, off_t);
+
+/* forget the memory copy, the cache file changed or is going away */
+void ram_drop(tpath_entry *);
+
+unsigned long long ram_get_bytes(void);
+
+#endif /* RAM_H */
@@ -1,10 +1,16 @@
 #include <errno.h>
+#include <stdlib.h>
 #include <droplet.h>
 #include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
 
 #include "read.h"
 #include "hash.h"
 #include "log.h"
+#include "file.h"
+#include "block.h"
+#include "ram.h"
 
 ssize_t pread(int, void *, size_t, off_t);
 
@@ -19,24 +25,153 @@ dfs_read(const char *path,
         tpath_entry *pe = (tpath_entry *)info->fh;
 
         LOG(LOG_DEBUG, "path=%s, buf=%p, size=%zu, offset=%lld, info=%p",
-            path, (void *)buf, size, (long long)offset, (void *)info);
+            pe->path, (void *)buf, size, (long long)offset, (void *)info);
+
+        if (pe->stream) {
+                ret = dfs_read_remote(pe, buf, size, offset);
+                goto end;
+        }
+
+        /* small and hot file, served from memory */
+        if (pe->ram) {
+                ret = ram_read(pe, buf, size, offset);
+                if (ret >= 0) {
+                        pe->last_access = time(NULL);
+                        goto end;
+                }
+        }
 
         if (pe->fd < 0) {
                 LOG(LOG_ERR, "unusable file descriptor fd=%d", pe->fd);
-                ret = -EBADFD;
+                ret = -EBADF;
                 goto end;
         }
 
+        if (pe->blocks) {
+                ret = block_acquire(pe, offset, size);
+                if (ret < 0)
+                        goto end;
+        }
+
         ret = pread(pe->fd, buf, size, offset);
+        pe->last_access = time(NULL);
+
+        if (pe->blocks)
+                block_release(pe);
 
         if (-1 == ret) {
                 LOG(LOG_ERR, "%s (fd=%d) - %s",
-                    path, pe->fd, strerror(errno));
+                    pe->path, pe->fd, strerror(errno));
+                ret = -errno;
+                goto end;
+        }
+
+  end:
+        if (ret > 0)
+                pe->bytes_read += ret;
+
+        LOG(LOG_DEBUG, "%s - %d bytes read", pe->path, ret);
+        return ret;
+}
+
+/* fill a memory buffer, when the file descriptor can't be handed over:
+ * no cache file at all, or holes may be punched in it before libfuse
+ * reads it; or when the content is in memory already */
+static int
+read_buf_mem(const char *path,
+             struct fuse_bufvec **bufp,
+             size_t size,
+             off_t offset,
+             struct fuse_file_info *info)
+{
+        tpath_entry *pe = (tpath_entry *)info->fh;
+        struct fuse_bufvec *src = NULL;
+        char *mem = NULL;
+        int ret;
+
+        src = malloc(sizeof *src);
+        mem = malloc(size);
+        if (! src || ! mem) {
+                LOG(LOG_ERR, "%s: out of memory", pe->path);
+                ret = -ENOMEM;
+                goto err;
+        }
+
+        ret = dfs_read(path, mem, size, offset, info);
+        if (ret < 0)
+                goto err;
+
+        *src = FUSE_BUFVEC_INIT(ret);
+        src->buf[0].mem = mem;
+        *bufp = src;
+
+        return 0;
+  err:
+        free(mem);
+        free(src);
+        return ret;
+}
+
+/* hand the cache file descriptor over to libfuse, which can splice it
+ * straight into /dev/fuse instead of copying through a user buffer */
+int
+dfs_read_buf(const char *path,
+             struct fuse_bufvec **bufp,
+             size_t size,
+             off_t offset,
+             struct fuse_file_info *info)
+{
+        int ret;
+        struct stat st;
+        tpath_entry *pe = (tpath_entry *)info->fh;
+        struct fuse_bufvec *src = NULL;
+
+        LOG(LOG_DEBUG, "path=%s, size=%zu, offset=%lld, info=%p",
+            pe->path, size, (long long)offset, (void *)info);
+
+        if (pe->stream || pe->blocks || pe->ram) {
+                ret = read_buf_mem(path, bufp, size, offset, info);
+                goto end;
+        }
+
+        if (pe->fd < 0) {
+                LOG(LOG_ERR, "unusable file descriptor fd=%d", pe->fd);
+                ret = -EBADF;
+                goto end;
+        }
+
+        /* libfuse reads no further than the end of the file: count what
+         * the application gets, not what it asked for */
+        if (-1 == fstat(pe->fd, &st)) {
+                LOG(LOG_ERR, "%s: fstat(fd=%d): %s",
+                    pe->path, pe->fd, strerror(errno));
                 ret = -errno;
                 goto end;
         }
 
+        if (offset >= st.st_size)
+                size = 0;
+        else if ((off_t)size > st.st_size - offset)
+                size = st.st_size - offset;
+
+        src = malloc(sizeof *src);
+        if (! src) {
+                LOG(LOG_ERR, "%s: out of memory", pe->path);
+                ret = -ENOMEM;
+                goto end;
+        }
+
+        *src = FUSE_BUFVEC_INIT(size);
+        src->buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+        src->buf[0].fd = pe->fd;
+        src->buf[0].pos = offset;
+        pe->last_access = time(NULL);
+        pe->bytes_read += size;
+
+        *bufp = src;
+
+        ret = 0;
   end:
-        LOG(LOG_DEBUG, "%s - %d bytes read", path, ret);
+        LOG(LOG_DEBUG, "path=%s, ret=%d", pe->path, ret);
         return ret;
 }
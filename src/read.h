@@ -4,5 +4,6 @@
 #include <fuse.h>
 
 int dfs_read(const char *, char *, size_t, off_t, struct fuse_file_info *);
+int dfs_read_buf(const char *, struct fuse_bufvec **, size_t, off_t, struct fuse_file_info *);
 
 #endif /* READ_H */
@@ -6,6 +6,8 @@
 #include "timeout.h"
 #include "hash.h"
 #include "list.h"
+#include "tmpstr.h"
+#include "delete.h"
 
 extern dpl_ctx_t *ctx;
 extern GHashTable *hash;
@@ -20,19 +22,20 @@ dfs_readdir(const char *path,
         void *dir_hdl;
         dpl_dirent_t dirent;
         dpl_status_t rc = DPL_FAILURE;
+        tpath_entry *pe = NULL;
         int ret;
 
+        /* libfuse does not build the path of an open directory */
+        pe = (tpath_entry *)info->fh;
+        if (pe)
+                path = pe->path;
+
         LOG(LOG_DEBUG, "path=%s, data=%p, fill=%p, offset=%lld, info=%p",
             path, data, (void *)fill, (long long)offset, (void *)info);
 
-        rc = dfs_chdir_timeout(ctx, path);
-        if (DPL_SUCCESS != rc) {
-                LOG(LOG_ERR, "dfs_chdir_timeout: %s", dpl_status_str(rc));
-                ret = rc;
-                goto err;
-        }
-
-        rc = dfs_opendir_timeout(ctx, ".", &dir_hdl);
+        /* by its full path: the working directory of the context is
+         * shared by every thread */
+        rc = dfs_opendir_timeout(ctx, path, &dir_hdl);
         if (DPL_SUCCESS != rc) {
                 LOG(LOG_ERR, "dfs_opendir_timeout: %s", dpl_status_str(rc));
                 ret = rc;
@@ -40,6 +43,12 @@ dfs_readdir(const char *path,
         }
 
         while (DPL_SUCCESS == dpl_readdir(dir_hdl, &dirent)) {
+                /* removed, the store may not know it yet */
+                if (delete_pending(tmpstr_printf("%s/%s",
+                                                 strcmp(path, "/") ? path : "",
+                                                 dirent.name)))
+                        continue;
+
                 if (0 != fill(data, dirent.name, NULL, 0))
                         break;
         }
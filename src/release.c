@@ -7,7 +7,14 @@
 #include "metadata.h"
 #include "log.h"
 #include "zip.h"
-
+#include "lru.h"
+#include "local.h"
+#include "trace.h"
+#include "throttle.h"
+#include "endpoint.h"
+#include "breaker.h"
+
+extern GHashTable *hash;
 extern dpl_ctx_t *ctx;
 extern struct conf *conf;
 
@@ -78,16 +85,20 @@ compress_before_sending(FILE *fpsrc,
 
 }
 
-int
-dfs_release(const char *path,
-            struct fuse_file_info *info)
+/* send the cache file of `pe', open on `fd', return 0 or -1 */
+static int
+upload(tpath_entry *pe,
+       int fd,
+       struct stat *st)
 {
-        tpath_entry *pe = NULL;
+        const char *path = pe->path;
         dpl_canned_acl_t canned_acl = DPL_CANNED_ACL_PRIVATE;
         dpl_vfile_t *vfile = NULL;
         dpl_status_t rc = DPL_FAILURE;
+        /* what the store answered, for the throttle and the endpoint: the
+         * local errors say nothing about its load */
+        dpl_status_t status = DPL_SUCCESS;
         dpl_dict_t *dict = NULL;
-        struct stat st;
         int ret = -1;
         size_t size = 0;
         size_t zsize = 0;
@@ -98,43 +109,11 @@ dfs_release(const char *path,
         FILE *fpsrc = NULL;
         FILE *fpdst = NULL;
         unsigned flags = DPL_VFILE_FLAG_CREAT|DPL_VFILE_FLAG_MD5;
+        struct throttle throttle = { .counted = 0 };
+        enum throttle_class class;
+        struct endpoint *ep = NULL;
 
-        LOG(LOG_DEBUG, "path=%s, %s", path, flags_to_str(info->flags));
-
-        pe = (tpath_entry *)info->fh;
-        if (! pe) {
-                LOG(LOG_ERR, "no path entry");
-                goto err;
-        }
-
-        if (pe->fd < 0) {
-                LOG(LOG_ERR, "unusable file descriptor fd=%d", pe->fd);
-                goto err;
-        }
-
-        if (-1 == fstat(pe->fd, &st)) {
-                LOG(LOG_ERR, "fstat(fd=%d) = %s", pe->fd, strerror(errno));
-                goto err;
-        }
-
-        pentry_dec_refcount(pe);
-
-        /* We opened a file but we do not want to update it on the server since
-         * it was for read-only purposes */
-        if (O_RDONLY == (info->flags & O_ACCMODE)) {
-                LOG(LOG_INFO, "path=%s, fd=%d was opened in O_RDONLY mode",
-                    pe->path, pe->fd);
-                ret = 0;
-                goto end;
-        }
-
-        if (pe->exclude) {
-                LOG(LOG_INFO, "%s: matches a -x regex, don't upload", path);
-                ret = 0;
-                goto exc;
-        }
-
-        size = st.st_size;
+        size = st->st_size;
 
         dict = dpl_dict_new(13);
         if (! dict) {
@@ -143,10 +122,10 @@ dfs_release(const char *path,
                 goto err;
         }
 
-        fill_metadata_from_stat(dict, &st);
-        fd_tosend = pe->fd;
+        fill_metadata_from_stat(dict, st);
+        fd_tosend = fd;
 
-        local = tmpstr_printf("%s/%s", conf->cache_dir, path);
+        local = local_path(path);
 
         if (0 == strncasecmp(conf->compression_method, "zlib", strlen("zlib"))) {
                 zlocal = tmpstr_printf("%s.tmp", local);
@@ -185,7 +164,13 @@ dfs_release(const char *path,
         if (! strncasecmp(conf->encryption_method, AES, AES_LEN))
                 flags |= DPL_VFILE_FLAG_ENCRYPT;
 
-        rc = dpl_openwrite(ctx,
+        /* the upload takes its place among the requests in flight, until
+         * dpl_close() */
+        class = throttle_set_class(THROTTLE_WRITEBACK);
+        throttle_enter(&throttle, 0);
+        (void)throttle_set_class(class);
+        ep = endpoint_get();
+        rc = dpl_openwrite(endpoint_ctx(ep),
                            (char *)path,
                            flags,
                            dict,
@@ -195,15 +180,25 @@ dfs_release(const char *path,
 
         if (DPL_SUCCESS != rc) {
                 LOG(LOG_ERR, "dpl_openwrite: %s", dpl_status_str(rc));
+                status = rc;
                 ret = -1;
                 goto err;
         }
 
-        if (-1 == read_write_all_vfile(fd_tosend, vfile)) {
+        if (-1 == read_write_all_vfile(fd_tosend, vfile, &status)) {
                 ret = -1;
                 goto err;
         }
 
+        /* keep what we sent, so the metadata refresh does not take our
+         * own upload for a remote change */
+        pentry_md_lock(pe);
+        (void)pentry_set_usermd(pe, dict);
+        pentry_md_unlock(pe);
+
+        /* account the new size of the cache file */
+        lru_touch(pe);
+
         ret = 0;
   err:
         if (dict)
@@ -213,16 +208,22 @@ dfs_release(const char *path,
                 rc = dpl_close(vfile);
                 if (DPL_SUCCESS != rc) {
                         LOG(LOG_ERR, "dpl_close: %s", dpl_status_str(rc));
+                        if (DPL_SUCCESS == status)
+                                status = rc;
                         ret = -1;
                 }
         }
 
+        if (ep)
+                endpoint_put(ep, status, NULL);
+        throttle_leave(&throttle, status);
+
         if (fpsrc)
                 fclose(fpsrc);
 
-        if (-1 == lseek(pe->fd, 0, SEEK_SET))
+        if (-1 == lseek(fd, 0, SEEK_SET))
                 LOG(LOG_ERR, "lseek(fd=%d, 0, SEEK_SET): %s",
-                    pe->fd, strerror(errno));
+                    fd, strerror(errno));
 
         if (fpdst)
                 fclose(fpdst);
@@ -233,13 +234,132 @@ dfs_release(const char *path,
                         LOG(LOG_ERR, "unlink: %s", strerror(errno));
         }
 
-  exc:
-        if (pe) {
-                pe->flag = FLAG_CLEAN;
-                (void) pentry_unlock(pe);
+        return ret;
+}
+
+int
+dfs_release(const char *path,
+            struct fuse_file_info *info)
+{
+        tpath_entry *pe = NULL;
+        struct stat st;
+        int ret = -1;
+
+        pe = (tpath_entry *)info->fh;
+        if (! pe) {
+                LOG(LOG_ERR, "no path entry");
+                goto end;
+        }
+
+        /* libfuse does not build the path of an open file (flag_nopath) */
+        path = pe->path;
+
+        LOG(LOG_DEBUG, "path=%s, %s", path, flags_to_str(info->flags));
+
+        trace_record(path, pe->bytes_read);
+        pe->bytes_read = 0;
+
+        /* read from the remote object, nothing to upload */
+        if (pe->stream) {
+                pentry_dec_refcount(pe);
+                ret = 0;
+                goto end;
         }
 
+        if (pe->fd < 0) {
+                LOG(LOG_ERR, "unusable file descriptor fd=%d", pe->fd);
+                pentry_dec_refcount(pe);
+                goto exc;
+        }
+
+        if (-1 == fstat(pe->fd, &st)) {
+                LOG(LOG_ERR, "fstat(fd=%d) = %s", pe->fd, strerror(errno));
+                pentry_dec_refcount(pe);
+                goto exc;
+        }
+
+        pentry_dec_refcount(pe);
+
+        /* We opened a file but we do not want to update it on the server since
+         * it was for read-only purposes */
+        if (O_RDONLY == (info->flags & O_ACCMODE)) {
+                LOG(LOG_INFO, "path=%s, fd=%d was opened in O_RDONLY mode",
+                    pe->path, pe->fd);
+                ret = 0;
+                goto end;
+        }
+
+        if (pe->exclude) {
+                LOG(LOG_INFO, "%s: matches a -x regex, don't upload", path);
+                ret = 0;
+                goto exc;
+        }
+
+        if (! breaker_open())
+                ret = upload(pe, pe->fd, &st);
+
+        /* the store is out of reach, or went away during the upload: the
+         * cache file stays dirty, it is sent once the store is back */
+        if (ret && breaker_open()) {
+                breaker_queue(path);
+                ret = 0;
+                goto end;
+        }
+
+  exc:
+        pe->flag = FLAG_CLEAN;
+
   end:
+        if (pe && pe->transient)
+                lru_forget(pe);
+
         LOG(LOG_DEBUG, "path=%s ret=%s", path, dpl_status_str(ret));
         return ret;
 }
+
+int
+dfs_upload_queued(const char *path)
+{
+        tpath_entry *pe = NULL;
+        struct stat st;
+        int fd = -1;
+        int ret;
+
+        pe = g_hash_table_lookup(hash, path);
+        if (! pe || FLAG_DIRTY != pe->flag) {
+                LOG(LOG_INFO, "%s: nothing left to upload", path);
+                ret = 0;
+                goto end;
+        }
+
+        /* open again, its release will tell */
+        if (pentry_get_refcount(pe) || pentry_trylock(pe)) {
+                ret = -1;
+                goto end;
+        }
+
+        fd = open(pentry_cache_path(pe), O_RDONLY);
+        if (-1 == fd) {
+                LOG(LOG_ERR, "%s: %s", pentry_cache_path(pe), strerror(errno));
+                ret = 0;
+                goto unlock;
+        }
+
+        if (-1 == fstat(fd, &st)) {
+                LOG(LOG_ERR, "fstat(fd=%d) = %s", fd, strerror(errno));
+                ret = -1;
+                goto unlock;
+        }
+
+        ret = upload(pe, fd, &st);
+        if (0 == ret)
+                pe->flag = FLAG_CLEAN;
+  unlock:
+        pentry_unlock(pe);
+  end:
+        if (-1 != fd)
+                close(fd);
+
+        LOG(LOG_DEBUG, "path=%s ret=%d", path, ret);
+        return ret;
+}
@@ -5,4 +5,8 @@
 
 int dfs_release(const char *, struct fuse_file_info *);
 
+/* send a file closed while the store was out of reach, return 0 once
+ * there is nothing left to send, -1 to try again later */
+int dfs_upload_queued(const char *);
+
 #endif /* RELEASE_H */
@@ -1,4 +1,8 @@
+#include <errno.h>
 #include <glib.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
 #include <droplet.h>
 
 #include "rename.h"
@@ -10,132 +14,471 @@
 #include "mkdir.h"
 #include "rmdir.h"
 #include "tmpstr.h"
+#include "delete.h"
+#include "local.h"
+#include "lru.h"
+
+/* files between two progress lines in the log */
+#define RENAME_PROGRESS 1000
 
 extern dpl_ctx_t *ctx;
 extern GHashTable *hash;
+extern struct conf *conf;
+
+/* the files of one directory rename */
+struct rename_batch {
+        const char *root;
+        pthread_mutex_t mutex;
+        pthread_cond_t cond;
+        unsigned total;
+        unsigned done;
+        unsigned failed;
+};
+
+/* a file to copy on the server side, then remove */
+struct rename_job {
+        struct rename_batch *batch;
+        char *oldpath;
+        char *newpath;
+        int ret;
+};
+
+/* a directory to list, and where its content goes */
+struct rename_dir {
+        char *oldpath;
+        char *newpath;
+};
+
+static GThreadPool *rename_pool = NULL;
+
+/* every rename in progress, for user.dplfs.rename */
+static pthread_mutex_t progress_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int running = 0;
+static unsigned long long files_found = 0;
+static unsigned long long files_done = 0;
+static unsigned long long files_failed = 0;
+
+/* Keep what we know of the file under its new name: its metadata, and
+ * its cache file moved along, rather than download it again.  An open
+ * file keeps its entry, its handle holds it. */
+static void
+rename_rekey(const char *oldpath,
+             const char *newpath)
+{
+        tpath_entry *pe = NULL;
+        tpath_entry *target = NULL;
+        tpath_entry *pe_dir = NULL;
+        gpointer oldkey = NULL;
+        char *oldlocal = NULL;
+        char *newlocal = NULL;
+        char *key = NULL;
+
+        if (! g_hash_table_lookup_extended(hash, oldpath, &oldkey,
+                                           (gpointer *)&pe))
+                return;
+
+        target = g_hash_table_lookup(hash, newpath);
+
+        if (pentry_get_refcount(pe) || FLAG_DIRTY == pe->flag ||
+            (target && pentry_get_refcount(target))) {
+                LOG(LOG_NOTICE, "%s: in use, its entry stays", oldpath);
+                return;
+        }
+
+        key = strdup(newpath);
+        if (! key) {
+                LOG(LOG_ERR, "%s: strdup: %s", newpath, strerror(errno));
+                return;
+        }
+
+        /* the previous target is replaced, its cache file first */
+        if (target) {
+                lru_remove(target);
+                pentry_unlink_cache_file(target);
+                lru_set_fd(target, -1);
+        }
+
+        if (FILE_LOCAL == pe->ondisk) {
+                oldlocal = strdup(pentry_cache_path(pe));
+                newlocal = local_prepare(newpath);
+                if (! oldlocal || ! newlocal ||
+                    -1 == rename(oldlocal, newlocal)) {
+                        LOG(LOG_NOTICE, "%s: cache file not moved: %s",
+                            oldpath, strerror(errno));
+                        lru_remove(pe);
+                        pentry_unlink_cache_file(pe);
+                        lru_set_fd(pe, -1);
+                        pe->ondisk = pe->usermd ? FILE_REMOTE : FILE_UNSET;
+                }
+                free(oldlocal);
+        }
+
+        pe_dir = pentry_get_parent(pe);
+        if (pe_dir)
+                (void)pentry_remove_dirent(pe_dir, oldpath);
+
+        g_hash_table_steal(hash, oldpath);
+        free(oldkey);
+        pentry_set_path(pe, newpath);
+        g_hash_table_replace(hash, key, pe);
+
+        pe_dir = pentry_get_parent(pe);
+        if (pe_dir) {
+                (void)pentry_remove_dirent(pe_dir, newpath);
+                pentry_add_dirent(pe_dir, newpath);
+        }
+}
 
 static int
-rename_file(const char *oldpath,
+rename_copy(const char *oldpath,
             const char *newpath)
 {
-        int ret;
         dpl_status_t rc;
-        char *p = NULL;
-        char *dirname = NULL;
-        tpath_entry *pe_dir = NULL;
 
+        rc = dfs_fcopy_timeout(ctx, oldpath, newpath);
+        if (DPL_SUCCESS != rc) {
+                LOG(LOG_ERR, "%s: dfs_fcopy_timeout: %s",
+                    oldpath, dpl_status_str(rc));
+                return -1;
+        }
+
+        /* the copy is there, the source goes in the background */
+        if (0 == delete_queue(oldpath))
+                return 0;
+
+        rc = dfs_unlink_timeout(ctx, oldpath);
+        if (DPL_SUCCESS != rc && DPL_ENOENT != rc) {
+                LOG(LOG_ERR, "%s: dfs_unlink_timeout: %s",
+                    oldpath, dpl_status_str(rc));
+                return -1;
+        }
+
+        return 0;
+}
+
+static int
+rename_file(const char *oldpath,
+            const char *newpath)
+{
         LOG(LOG_DEBUG, "%s -> %s", oldpath, newpath);
 
-        rc = dfs_fcopy_timeout(ctx, oldpath, newpath);
+        if (-1 == rename_copy(oldpath, newpath))
+                return -1;
+
+        rename_rekey(oldpath, newpath);
+
+        return 0;
+}
+
+static void
+rename_worker(gpointer data,
+              gpointer user_data)
+{
+        struct rename_job *job = data;
+        struct rename_batch *batch = job->batch;
+        int ret;
+
+        (void)user_data;
+
+        ret = rename_copy(job->oldpath, job->newpath);
+        job->ret = ret;
+
+        pthread_mutex_lock(&progress_mutex);
+        files_done++;
+        if (ret)
+                files_failed++;
+        pthread_mutex_unlock(&progress_mutex);
+
+        /* the last one wakes rename_directory(), which frees the job and
+         * the batch: nothing of them is used after the signal */
+        pthread_mutex_lock(&batch->mutex);
+        if (ret)
+                batch->failed++;
+        if (0 == ++batch->done % RENAME_PROGRESS)
+                LOG(LOG_NOTICE, "%s: %u files renamed",
+                    batch->root, batch->done);
+        pthread_cond_signal(&batch->cond);
+        pthread_mutex_unlock(&batch->mutex);
+}
+
+static struct rename_job *
+rename_job_new(struct rename_batch *batch,
+               const char *oldpath,
+               const char *newpath)
+{
+        struct rename_job *job = NULL;
+
+        job = calloc(1, sizeof *job);
+        if (! job) {
+                LOG(LOG_ERR, "calloc: %s", strerror(errno));
+                return NULL;
+        }
+
+        job->batch = batch;
+        job->oldpath = strdup(oldpath);
+        job->newpath = strdup(newpath);
+        if (! job->oldpath || ! job->newpath) {
+                LOG(LOG_ERR, "strdup: %s", strerror(errno));
+                free(job->oldpath);
+                free(job->newpath);
+                free(job);
+                return NULL;
+        }
+
+        return job;
+}
+
+static void
+rename_job_free(struct rename_job *job)
+{
+        free(job->oldpath);
+        free(job->newpath);
+        free(job);
+}
+
+static struct rename_dir *
+rename_dir_new(const char *oldpath,
+               const char *newpath)
+{
+        struct rename_dir *dir = NULL;
+
+        dir = calloc(1, sizeof *dir);
+        if (! dir) {
+                LOG(LOG_ERR, "calloc: %s", strerror(errno));
+                return NULL;
+        }
+
+        dir->oldpath = strdup(oldpath);
+        dir->newpath = strdup(newpath);
+        if (! dir->oldpath || ! dir->newpath) {
+                LOG(LOG_ERR, "strdup: %s", strerror(errno));
+                free(dir->oldpath);
+                free(dir->newpath);
+                free(dir);
+                return NULL;
+        }
+
+        return dir;
+}
+
+static void
+rename_dir_free(struct rename_dir *dir)
+{
+        free(dir->oldpath);
+        free(dir->newpath);
+        free(dir);
+}
+
+/* `name' in the directory `dir', without the slash of a directory */
+static char *
+rename_child(const char *dir,
+             const char *name)
+{
+        char *child = NULL;
+        size_t len;
+
+        child = tmpstr_printf("%s/%s", strcmp(dir, "/") ? dir : "", name);
+        len = strlen(child);
+        if (len > 1 && '/' == child[len - 1])
+                child[len - 1] = 0;
+
+        return child;
+}
+
+/* Queue the files of `dir' for their copy, and append its subdirectories
+ * to `dirs', created first.  Return -1 if it can't be listed. */
+static int
+rename_list(struct rename_batch *batch,
+            struct rename_dir *dir,
+            GQueue *dirs,
+            GQueue *jobs)
+{
+        void *dir_hdl = NULL;
+        dpl_dirent_t dirent;
+        dpl_status_t rc;
+        struct rename_job *job = NULL;
+        struct rename_dir *sub = NULL;
+        char *src = NULL;
+        int ret;
+
+        rc = dfs_opendir_timeout(ctx, dir->oldpath, &dir_hdl);
         if (DPL_SUCCESS != rc) {
-                LOG(LOG_ERR, "dfs_fcopy_timeout: %s", dpl_status_str(rc));
-                ret = -1;
-                goto err;
+                LOG(LOG_ERR, "%s: dfs_opendir_timeout: %s",
+                    dir->oldpath, dpl_status_str(rc));
+                return -1;
         }
 
-        dirname = (char *)newpath;
-        p = strrchr(dirname, '/');
-        if (p) {
-                if (p != newpath) {
-                        *p = 0;
-                        pe_dir = g_hash_table_lookup(hash, dirname);
-                        *p = '/';
-                        if (pe_dir)
-                                (void)pentry_remove_dirent(pe_dir, oldpath);
+        ret = 0;
+
+        while (DPL_SUCCESS == dpl_readdir(dir_hdl, &dirent)) {
+                if (! strcmp(dirent.name, ".") || ! strcmp(dirent.name, ".."))
+                        continue;
+
+                src = rename_child(dir->oldpath, dirent.name);
+
+                if (DPL_FTYPE_DIR == dirent.type) {
+                        sub = rename_dir_new(src, rename_child(dir->newpath,
+                                                               dirent.name));
+                        if (! sub || -1 == dfs_mkdir(sub->newpath, 0755)) {
+                                if (sub)
+                                        rename_dir_free(sub);
+                                ret = -1;
+                                break;
+                        }
+                        g_queue_push_tail(dirs, sub);
+                        continue;
                 }
+
+                job = rename_job_new(batch, src,
+                                     rename_child(dir->newpath, dirent.name));
+                if (! job) {
+                        ret = -1;
+                        break;
+                }
+
+                g_queue_push_tail(jobs, job);
+
+                pthread_mutex_lock(&batch->mutex);
+                batch->total++;
+                pthread_mutex_unlock(&batch->mutex);
+
+                pthread_mutex_lock(&progress_mutex);
+                files_found++;
+                pthread_mutex_unlock(&progress_mutex);
+
+                if (rename_pool)
+                        g_thread_pool_push(rename_pool, job, NULL);
+                else
+                        rename_worker(job, NULL);
         }
 
-        ret = dfs_unlink(oldpath);
-  err:
+        dpl_closedir(dir_hdl);
+
         return ret;
 }
 
+/* The subtree is listed once, breadth-first, by its full paths: the
+ * files go to the copy workers as they are found, the directories are
+ * created before their content.  Once every copy is done, the entries
+ * are moved in the hashtable and the source directories removed, the
+ * deepest first. */
 static int
 rename_directory(const char *oldpath,
                  const char *newpath)
 {
-        void *dir_hdl = NULL;
-        dpl_dirent_t dirent;
+        struct rename_batch batch;
+        struct rename_job *job = NULL;
+        GQueue dirs = G_QUEUE_INIT; /* parents first */
+        GQueue jobs = G_QUEUE_INIT;
+        GList *l = NULL;
+        struct rename_dir *dir = NULL;
         dpl_status_t rc;
         dpl_ftype_t type;
         dpl_ino_t ino;
         int ret = 0;
-        char *src_entry = NULL;
-        char *dst_entry = NULL;
 
         LOG(LOG_DEBUG, "%s -> %s", oldpath, newpath);
 
+        memset(&batch, 0, sizeof batch);
+        batch.root = oldpath;
+        pthread_mutex_init(&batch.mutex, NULL);
+        pthread_cond_init(&batch.cond, NULL);
+
+        pthread_mutex_lock(&progress_mutex);
+        running++;
+        pthread_mutex_unlock(&progress_mutex);
+
         rc = dfs_namei_timeout(ctx, newpath, ctx->cur_bucket,
                                ino, NULL, NULL, &type);
         if (DPL_SUCCESS != rc && (DPL_ENOENT != rc)) {
                 LOG(LOG_ERR, "dpl_namei: %s", dpl_status_str(rc));
                 ret = -1;
-                goto err;
+                goto end;
         }
 
-        if (DPL_ENOENT == rc) {
-                rc = dfs_mkdir(newpath, 0755);
-                if (rc) {
-                        ret = -1;
-                        goto err;
-                }
+        if (DPL_ENOENT == rc && -1 == dfs_mkdir(newpath, 0755)) {
+                ret = -1;
+                goto end;
         }
 
-        rc = dfs_chdir_timeout(ctx, oldpath);
-        if (DPL_SUCCESS != rc) {
-                LOG(LOG_ERR, "dfs_chdir_timeout: %s", dpl_status_str(rc));
-                ret = rc;
-                goto err;
+        dir = rename_dir_new(oldpath, newpath);
+        if (! dir) {
+                ret = -1;
+                goto end;
         }
+        g_queue_push_tail(&dirs, dir);
 
-        rc = dfs_opendir_timeout(ctx, ".", &dir_hdl);
-        if (DPL_SUCCESS != rc) {
-                LOG(LOG_ERR, "dfs_opendir_timeout: %s", dpl_status_str(rc));
-                ret = rc;
-                goto err;
+        for (l = dirs.head; l && 0 == ret; l = l->next)
+                ret = rename_list(&batch, l->data, &dirs, &jobs);
+
+        pthread_mutex_lock(&batch.mutex);
+        while (batch.done < batch.total)
+                pthread_cond_wait(&batch.cond, &batch.mutex);
+        pthread_mutex_unlock(&batch.mutex);
+
+        LOG(LOG_INFO, "%s: %u files renamed, %u failed",
+            oldpath, batch.done - batch.failed, batch.failed);
+
+        while ((job = g_queue_pop_head(&jobs))) {
+                if (0 == job->ret)
+                        rename_rekey(job->oldpath, job->newpath);
+                rename_job_free(job);
         }
 
-        while (DPL_SUCCESS == dpl_readdir(dir_hdl, &dirent)) {
-                if (! strcmp(dirent.name, "."))
-                        continue;
-                if (! strcmp(dirent.name, ".."))
-                        continue;
+        if (batch.failed)
+                ret = -1;
+
+        /* what is left of the source can't go */
+        while ((dir = g_queue_pop_tail(&dirs))) {
+                if (0 == ret)
+                        (void)dfs_rmdir(dir->oldpath);
+                rename_dir_free(dir);
+        }
 
-                src_entry = tmpstr_printf("%s/%s", oldpath, dirent.name);
-                dst_entry = tmpstr_printf("%s/%s", newpath, dirent.name);
+  end:
+        pthread_mutex_lock(&progress_mutex);
+        running--;
+        pthread_mutex_unlock(&progress_mutex);
 
-                if ('/' == src_entry[strlen(src_entry) -1])
-                        src_entry[strlen(src_entry) - 1] = 0;
+        pthread_cond_destroy(&batch.cond);
+        pthread_mutex_destroy(&batch.mutex);
 
-                if ('/' == dst_entry[strlen(dst_entry) -1])
-                        dst_entry[strlen(dst_entry) -1] = 0;
+        return ret;
+}
 
-                rc = dfs_namei_timeout(ctx, src_entry, ctx->cur_bucket,
-                                       ino, NULL, NULL, &type);
+int
+rename_init(void)
+{
+        GError *err = NULL;
 
-                if (DPL_SUCCESS != rc && (DPL_ENOENT != rc)) {
-                        LOG(LOG_ERR, "dpl_namei: %s", dpl_status_str(rc));
-                        ret = -1;
-                        goto err;
-                }
+        if (! conf->rename_threads)
+                return 0;
 
-                if (DPL_FTYPE_DIR == type)
-                        ret = rename_directory(src_entry, dst_entry);
-                else
-                        ret = rename_file(src_entry, dst_entry);
+        rename_pool = g_thread_pool_new(rename_worker, NULL,
+                                        conf->rename_threads, FALSE, &err);
+        if (err) {
+                LOG(LOG_ERR, "rename thread pool creation: %s", err->message);
+                rename_pool = NULL;
+                return -1;
         }
 
-        if (-1 == ret)
-                goto err;
+        return 0;
+}
 
-        dfs_rmdir(oldpath);
+char *
+rename_progress(void)
+{
+        char *progress = NULL;
 
-        ret = 0;
-  err:
-        if (dir_hdl)
-                dpl_closedir(dir_hdl);
+        pthread_mutex_lock(&progress_mutex);
 
-        return ret;
+        progress = tmpstr_printf("running=%d files=%llu/%llu failed=%llu",
+                                 running, files_done, files_found,
+                                 files_failed);
+
+        pthread_mutex_unlock(&progress_mutex);
+
+        return progress;
 }
 
 int
@@ -155,6 +498,11 @@ dfs_rename(const char *oldpath,
                 newpath = p ? p + 1 : oldpath;
         }
 
+        /* neither the removals under the source nor those of the target
+         * may run behind the copies */
+        (void)delete_flush(oldpath);
+        (void)delete_flush(newpath);
+
         rc = dfs_namei_timeout(ctx, oldpath, ctx->cur_bucket,
                                ino, NULL, NULL, &type);
         if (! DPL_SUCCESS == rc && (DPL_ENOENT != rc)) {
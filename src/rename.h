@@ -3,4 +3,11 @@
 
 int dfs_rename(const char *, const char *);
 
+/* the pool of the server side copies of a directory rename, return 0 or
+ * -1 */
+int rename_init(void);
+/* the files renamed so far by the renames in progress, in a temporary
+ * string */
+char *rename_progress(void);
+
 #endif /* RENAME_H */
@@ -7,6 +7,8 @@
 #include "timeout.h"
 #include "hash.h"
 #include "tmpstr.h"
+#include "local.h"
+#include "delete.h"
 
 extern dpl_ctx_t *ctx;
 extern GHashTable *hash;
@@ -21,6 +23,12 @@ dfs_rmdir(const char *path)
 
         LOG(LOG_DEBUG, "path=%s", path);
 
+        /* the store would find it not empty yet */
+        if (-1 == delete_flush(path)) {
+                ret = -EIO;
+                goto err;
+        }
+
         rc = dfs_rmdir_timeout(ctx, path);
         if (DPL_SUCCESS != rc) {
                 LOG(LOG_ERR, "dfs_rmdir_timeout: %s", dpl_status_str(rc));
@@ -28,11 +36,14 @@ dfs_rmdir(const char *path)
                 goto err;
         }
 
-        local = tmpstr_printf("%s/%s", conf->cache_dir, path);
-        if (-1 == rmdir(local)) {
-                LOG(LOG_INFO, "rmdir cache directory (%s): %s", local,
-                    strerror(errno));
-                /* fallback: continue */
+        /* the flat layout has no directory per remote one */
+        if (! local_layout_is_flat()) {
+                local = local_path(path);
+                if (-1 == rmdir(local)) {
+                        LOG(LOG_INFO, "rmdir cache directory (%s): %s", local,
+                            strerror(errno));
+                        /* fallback: continue */
+                }
         }
 
         pe = g_hash_table_lookup(hash, path);
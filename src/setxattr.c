@@ -1,8 +1,37 @@
 #include <droplet.h>
+#include <errno.h>
+#include <sys/stat.h>
 
 #include "glob.h"
 #include "log.h"
 #include "setxattr.h"
+#include "pin.h"
+#include "prefetch.h"
+#include "getattr.h"
+
+#define XATTR_PIN "user.dplfs.pin"
+#define XATTR_PREFETCH "user.dplfs.prefetch"
+
+static int
+xattr_prefetch(const char *path)
+{
+        struct stat st;
+        int ret;
+
+        ret = dfs_getattr(path, &st);
+        if (ret)
+                return ret;
+
+        if (S_ISDIR(st.st_mode))
+                return prefetch_push_tree(path);
+
+        if (! S_ISREG(st.st_mode))
+                return -EINVAL;
+
+        prefetch_push(path);
+
+        return 0;
+}
 
 int
 dfs_setxattr(const char *path,
@@ -11,8 +40,34 @@ dfs_setxattr(const char *path,
              size_t size,
              int flag)
 {
-        LOG(LOG_DEBUG, "path=%s, name=%s, value=%s, size=%zu, flag=%d",
-            path, name, value, size, flag);
+        LOG(LOG_DEBUG, "path=%s, name=%s, value=%.*s, size=%zu, flag=%d",
+            path, name, (int)size, value, size, flag);
+
+        /* setfattr -n user.dplfs.pin -v 1 (or 0) <file or directory> */
+        if (! strcmp(name, XATTR_PIN)) {
+                if (1 != size || ('0' != *value && '1' != *value))
+                        return -EINVAL;
+                return pin_set(path, '1' == *value);
+        }
+
+        /* setfattr -n user.dplfs.prefetch -v 1 <file or directory> */
+        if (! strcmp(name, XATTR_PREFETCH)) {
+                if (1 != size || '1' != *value)
+                        return -EINVAL;
+                return xattr_prefetch(path);
+        }
+
+        return 0;
+}
+
+int
+dfs_removexattr(const char *path,
+                const char *name)
+{
+        LOG(LOG_DEBUG, "path=%s, name=%s", path, name);
+
+        if (! strcmp(name, XATTR_PIN))
+                return pin_set(path, 0);
 
         return 0;
 }
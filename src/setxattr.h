@@ -1,6 +1,9 @@
 #ifndef SETXATTR_H
 #define SETXATTR_H
 
+#include <sys/types.h>
+
 int dfs_setxattr(const char *, const char *, const char *, size_t, int);
+int dfs_removexattr(const char *, const char *);
 
 #endif /* SETXATTR_H */
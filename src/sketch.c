@@ -0,0 +1,99 @@
+#include <glib.h>
+#include <pthread.h>
+#include <stdint.h>
+
+#include "sketch.h"
+
+#define SKETCH_DEPTH 4
+#define SKETCH_WIDTH (1 << 16) /* counters per row, a power of 2 */
+#define SKETCH_MAX 255
+/* halve every counter after this number of increments */
+#define SKETCH_SAMPLE (10 * SKETCH_WIDTH)
+
+static uint8_t counters[SKETCH_DEPTH][SKETCH_WIDTH];
+static unsigned int additions = 0;
+static pthread_mutex_t sketch_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* FNV-1a, combined with g_str_hash() to get SKETCH_DEPTH indexes */
+static uint32_t
+fnv_hash(const char *key)
+{
+        uint32_t h = 2166136261U;
+
+        while (*key) {
+                h ^= (unsigned char)*key++;
+                h *= 16777619U;
+        }
+
+        return h;
+}
+
+static void
+sketch_indexes(const char *key,
+               uint32_t *idx)
+{
+        uint32_t h1 = g_str_hash(key);
+        uint32_t h2 = fnv_hash(key) | 1;
+        int i;
+
+        for (i = 0; i < SKETCH_DEPTH; i++)
+                idx[i] = (h1 + i * h2) & (SKETCH_WIDTH - 1);
+}
+
+static void
+sketch_age(void)
+{
+        int i, j;
+
+        for (i = 0; i < SKETCH_DEPTH; i++)
+                for (j = 0; j < SKETCH_WIDTH; j++)
+                        counters[i][j] >>= 1;
+
+        additions /= 2;
+}
+
+void
+sketch_increment(const char *key)
+{
+        uint32_t idx[SKETCH_DEPTH];
+        int i;
+
+        if (! key)
+                return;
+
+        sketch_indexes(key, idx);
+
+        pthread_mutex_lock(&sketch_mutex);
+
+        for (i = 0; i < SKETCH_DEPTH; i++)
+                if (counters[i][idx[i]] < SKETCH_MAX)
+                        counters[i][idx[i]]++;
+
+        if (++additions >= SKETCH_SAMPLE)
+                sketch_age();
+
+        pthread_mutex_unlock(&sketch_mutex);
+}
+
+int
+sketch_estimate(const char *key)
+{
+        uint32_t idx[SKETCH_DEPTH];
+        int min = SKETCH_MAX;
+        int i;
+
+        if (! key)
+                return 0;
+
+        sketch_indexes(key, idx);
+
+        pthread_mutex_lock(&sketch_mutex);
+
+        for (i = 0; i < SKETCH_DEPTH; i++)
+                if (counters[i][idx[i]] < min)
+                        min = counters[i][idx[i]];
+
+        pthread_mutex_unlock(&sketch_mutex);
+
+        return min;
+}
@@ -0,0 +1,9 @@
+#ifndef SKETCH_H
+#define SKETCH_H
+
+/* approximate access frequency of the recently seen paths (count-min
+ * sketch, periodically halved so that old popularity fades away) */
+void sketch_increment(const char *);
+int sketch_estimate(const char *);
+
+#endif /* SKETCH_H */
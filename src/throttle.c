@@ -0,0 +1,358 @@
+#include <glib.h>
+#include <pthread.h>
+
+#define FUSE_USE_VERSION 29
+#include <fuse.h>
+
+#include "throttle.h"
+#include "log.h"
+#include "tmpstr.h"
+
+/* a success slower than this many times the average does not open the
+ * window further */
+#define THROTTLE_SLOW 4
+
+extern struct conf *conf;
+
+/* the share of the window each class may use, in percent */
+static const int class_share[THROTTLE_NCLASSES] = {
+        [THROTTLE_FOREGROUND] = 100,
+        [THROTTLE_FG_META] = 100,
+        [THROTTLE_WRITEBACK] = 50,
+        [THROTTLE_PREFETCH] = 25,
+        [THROTTLE_REVALIDATE] = 25,
+};
+
+/* a request waiting for room */
+struct waiter {
+        enum throttle_class class;
+        uid_t uid;
+        int granted;
+        pthread_cond_t cond;
+};
+
+static __thread enum throttle_class thread_class = THROTTLE_FOREGROUND;
+
+static pthread_mutex_t throttle_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static double window = 0; /* requests allowed in flight */
+static int inflight = 0;
+static int class_inflight[THROTTLE_NCLASSES];
+static GHashTable *uid_inflight = NULL; /* uid -> requests in flight */
+static GQueue waiters = G_QUEUE_INIT; /* oldest first */
+static double avg_ms = 0;
+static struct timespec last_cut;
+static unsigned long long cuts = 0;
+static unsigned long long waits = 0;
+
+enum throttle_class
+throttle_set_class(enum throttle_class class)
+{
+        enum throttle_class prev = thread_class;
+
+        thread_class = class;
+
+        return prev;
+}
+
+static int
+elapsed_ms(struct timespec *start)
+{
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        return (now.tv_sec - start->tv_sec) * 1000 +
+                (now.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static int
+after(struct timespec *a,
+      struct timespec *b)
+{
+        return a->tv_sec > b->tv_sec ||
+                (a->tv_sec == b->tv_sec && a->tv_nsec > b->tv_nsec);
+}
+
+/* what the store answers when it has too much to do; libdroplet maps the
+ * 503 SlowDown replies to a plain failure */
+static int
+is_overload(dpl_status_t rc)
+{
+        switch (rc) {
+        case DPL_FAILURE:
+        case DPL_ETIMEOUT:
+        case DPL_EIO:
+        case DPL_ELIMIT:
+                return 1;
+        default:
+                return 0;
+        }
+}
+
+/* the user on whose behalf the calling thread works, root for the
+ * background threads */
+static uid_t
+caller_uid(void)
+{
+        struct fuse_context *fc = fuse_get_context();
+
+        if (! fc || ! fc->fuse)
+                return 0;
+
+        return fc->uid;
+}
+
+/* called with throttle_mutex held */
+static int
+uid_count(uid_t uid)
+{
+        gpointer n;
+
+        if (! uid_inflight)
+                return 0;
+
+        n = g_hash_table_lookup(uid_inflight, GINT_TO_POINTER(uid));
+
+        return GPOINTER_TO_INT(n);
+}
+
+/* called with throttle_mutex held */
+static void
+uid_add(uid_t uid,
+        int delta)
+{
+        int n;
+
+        if (! uid_inflight)
+                uid_inflight = g_hash_table_new(g_direct_hash,
+                                                g_direct_equal);
+
+        n = uid_count(uid) + delta;
+        if (n > 0)
+                g_hash_table_replace(uid_inflight, GINT_TO_POINTER(uid),
+                                     GINT_TO_POINTER(n));
+        else
+                g_hash_table_remove(uid_inflight, GINT_TO_POINTER(uid));
+}
+
+/* called with throttle_mutex held */
+static int
+can_start(enum throttle_class class)
+{
+        int cap;
+
+        if (window < 1)
+                window = conf->max_inflight;
+
+        if (inflight >= (int)window)
+                return 0;
+
+        /* a background class always gets one request through */
+        cap = (int)window * class_share[class] / 100;
+        if (cap < 1)
+                cap = 1;
+
+        return class_inflight[class] < cap;
+}
+
+/* Give the free room to the waiters: the most urgent class first, then,
+ * in a class, the user with the fewest requests in flight, so that the
+ * bulk job of one user does not starve the others, then the oldest.
+ * Called with throttle_mutex held. */
+static void
+dispatch(void)
+{
+        struct waiter *best = NULL;
+        struct waiter *w = NULL;
+        GList *l = NULL;
+
+        for (;;) {
+                best = NULL;
+
+                for (l = waiters.head; l; l = l->next) {
+                        w = l->data;
+
+                        if (! can_start(w->class))
+                                continue;
+
+                        if (! best || w->class < best->class ||
+                            (w->class == best->class &&
+                             uid_count(w->uid) < uid_count(best->uid)))
+                                best = w;
+                }
+
+                if (! best)
+                        break;
+
+                g_queue_remove(&waiters, best);
+
+                inflight++;
+                class_inflight[best->class]++;
+                uid_add(best->uid, 1);
+
+                best->granted = 1;
+                pthread_cond_signal(&best->cond);
+        }
+}
+
+static void
+throttle_start(struct throttle *t,
+               int timed)
+{
+        t->timed = timed;
+        t->counted = !! conf->max_inflight;
+        clock_gettime(CLOCK_MONOTONIC, &t->start);
+}
+
+/* called with throttle_mutex held, return 1 if the request can go now */
+static int
+throttle_queue(struct throttle *t,
+               struct waiter *w,
+               int timed)
+{
+        t->class = thread_class;
+        if (THROTTLE_FOREGROUND == t->class && timed)
+                t->class = THROTTLE_FG_META;
+        t->uid = caller_uid();
+
+        w->class = t->class;
+        w->uid = t->uid;
+        w->granted = 0;
+        pthread_cond_init(&w->cond, NULL);
+
+        g_queue_push_tail(&waiters, w);
+        dispatch();
+
+        return w->granted;
+}
+
+void
+throttle_enter(struct throttle *t,
+               int timed)
+{
+        struct waiter w;
+
+        if (! conf->max_inflight) {
+                throttle_start(t, timed);
+                return;
+        }
+
+        pthread_mutex_lock(&throttle_mutex);
+
+        if (! throttle_queue(t, &w, timed)) {
+                waits++;
+                while (! w.granted)
+                        pthread_cond_wait(&w.cond, &throttle_mutex);
+        }
+
+        pthread_mutex_unlock(&throttle_mutex);
+
+        pthread_cond_destroy(&w.cond);
+        throttle_start(t, timed);
+}
+
+int
+throttle_try_enter(struct throttle *t,
+                   int timed)
+{
+        struct waiter w;
+        int granted;
+
+        if (! conf->max_inflight) {
+                throttle_start(t, timed);
+                return 0;
+        }
+
+        pthread_mutex_lock(&throttle_mutex);
+
+        granted = throttle_queue(t, &w, timed);
+        if (! granted)
+                g_queue_remove(&waiters, &w);
+
+        pthread_mutex_unlock(&throttle_mutex);
+
+        pthread_cond_destroy(&w.cond);
+
+        if (! granted)
+                return -1;
+
+        throttle_start(t, timed);
+
+        return 0;
+}
+
+void
+throttle_leave(struct throttle *t,
+               dpl_status_t rc)
+{
+        int ms;
+        int quick;
+
+        if (! t->counted)
+                return;
+
+        ms = elapsed_ms(&t->start);
+
+        pthread_mutex_lock(&throttle_mutex);
+
+        inflight--;
+        class_inflight[t->class]--;
+        uid_add(t->uid, -1);
+
+        if (is_overload(rc)) {
+                /* once per round trip: the requests sent before the last
+                 * cut were already answered with the old window in mind */
+                if (after(&t->start, &last_cut)) {
+                        window /= 2;
+                        if (window < 1)
+                                window = 1;
+                        cuts++;
+                        clock_gettime(CLOCK_MONOTONIC, &last_cut);
+                        LOG(LOG_NOTICE, "%s, %d requests allowed in flight",
+                            dpl_status_str(rc), (int)window);
+                }
+        } else if (DPL_SUCCESS == rc) {
+                quick = ! t->timed || avg_ms <= 0 || ms <= THROTTLE_SLOW * avg_ms;
+
+                if (t->timed)
+                        avg_ms = avg_ms > 0 ? avg_ms + (ms - avg_ms) / 16 : ms;
+
+                /* about one more request per window of answers */
+                if (quick && window < conf->max_inflight) {
+                        window += 1 / window;
+                        if (window > conf->max_inflight)
+                                window = conf->max_inflight;
+                }
+        }
+
+        /* the room, and maybe a larger window, goes to the waiters */
+        dispatch();
+
+        pthread_mutex_unlock(&throttle_mutex);
+}
+
+char *
+throttle_stats(void)
+{
+        char *stats = NULL;
+
+        pthread_mutex_lock(&throttle_mutex);
+
+        stats = tmpstr_printf("limit=%d max=%d inflight=%d cuts=%llu "
+                              "waits=%llu avg_ms=%d waiting=%u fg=%d "
+                              "fg_meta=%d writeback=%d prefetch=%d "
+                              "revalidate=%d",
+                              (int)(window >= 1 ? window : conf->max_inflight),
+                              conf->max_inflight, inflight, cuts, waits,
+                              (int)avg_ms, g_queue_get_length(&waiters),
+                              class_inflight[THROTTLE_FOREGROUND],
+                              class_inflight[THROTTLE_FG_META],
+                              class_inflight[THROTTLE_WRITEBACK],
+                              class_inflight[THROTTLE_PREFETCH],
+                              class_inflight[THROTTLE_REVALIDATE]);
+
+        pthread_mutex_unlock(&throttle_mutex);
+
+        return stats;
+}
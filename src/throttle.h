@@ -0,0 +1,45 @@
+#ifndef THROTTLE_H
+#define THROTTLE_H
+
+#include <time.h>
+#include <sys/types.h>
+#include <droplet.h>
+
+/* Who is waiting for the object store, most urgent first.  The threads
+ * serving the mount point are in the foreground, their metadata requests
+ * go after their reads and opens; the others say what they are. */
+enum throttle_class {
+        THROTTLE_FOREGROUND,
+        THROTTLE_FG_META,
+        THROTTLE_WRITEBACK,
+        THROTTLE_PREFETCH,
+        THROTTLE_REVALIDATE,
+        THROTTLE_NCLASSES,
+};
+
+/* A request to the object store, between throttle_enter() and
+ * throttle_leave().  Its latency only counts if `timed', transfers take
+ * as long as their size. */
+struct throttle {
+        struct timespec start;
+        int timed;
+        int counted;
+        enum throttle_class class;
+        uid_t uid;
+};
+
+/* the class of the requests of the calling thread, from now on; return
+ * the previous one, to put it back */
+enum throttle_class throttle_set_class(enum throttle_class);
+
+/* wait for room in the window of requests in flight */
+void throttle_enter(struct throttle *, int);
+/* same, but return -1 instead of waiting */
+int throttle_try_enter(struct throttle *, int);
+/* grow the window on a quick success, halve it when the store chokes */
+void throttle_leave(struct throttle *, dpl_status_t);
+
+/* the window and its events, in a temporary string */
+char *throttle_stats(void);
+
+#endif /* THROTTLE_H */
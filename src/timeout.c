@@ -1,14 +1,196 @@
+#include <errno.h>
+#include <glib.h>
+#include <time.h>
 #include <unistd.h>
 
+#define FUSE_USE_VERSION 29
+#include <fuse.h>
+
 #include "timeout.h"
+#include "hedge.h"
+#include "throttle.h"
+#include "endpoint.h"
+#include "breaker.h"
 #include "log.h"
 
-#define ERR_TIMEOUT(func) do {                                  \
-                LOG(LOG_ERR, #func ": %s", dpl_status_str(rc)); \
-                tries++;                                        \
-                sleep(delay);                                   \
-                delay *= 2;                                     \
-        } while (0)
+/* decorrelated jitter: each wait is drawn between RETRY_BASE and three
+ * times the previous one, up to RETRY_CAP (milliseconds) */
+#define RETRY_BASE 100
+#define RETRY_CAP 10000
+/* how often a waiting caller looks for an interruption */
+#define RETRY_SLICE 50
+
+struct retry {
+        const char *op;
+        int tries;
+        int delay; /* last wait, in ms */
+        int deadline; /* total budget, in ms */
+        int failed_over; /* sent again at once, to another endpoint */
+        struct timespec start;
+};
+
+static volatile int retry_shutdown = 0;
+
+void
+dfs_retry_shutdown(void)
+{
+        retry_shutdown = 1;
+}
+
+/* return DPL_SUCCESS, DFS_EINTR if the caller was interrupted, or
+ * DPL_ETIMEOUT at once if the store is out of reach */
+static dpl_status_t
+retry_init(struct retry *r,
+           const char *op,
+           int deadline)
+{
+        r->op = op;
+        r->tries = 0;
+        r->failed_over = 0;
+        r->delay = RETRY_BASE;
+        r->deadline = deadline * 1000;
+        clock_gettime(CLOCK_MONOTONIC, &r->start);
+
+        /* nobody is waiting for the answer anymore */
+        if (dfs_interrupted()) {
+                LOG(LOG_NOTICE, "%s: interrupted", op);
+                return DFS_EINTR;
+        }
+
+        if (breaker_open()) {
+                LOG(LOG_INFO, "%s: the store is out of reach", op);
+                return DPL_ETIMEOUT;
+        }
+
+        return DPL_SUCCESS;
+}
+
+static int
+retry_elapsed(struct retry *r)
+{
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        return (now.tv_sec - r->start.tv_sec) * 1000 +
+                (now.tv_nsec - r->start.tv_nsec) / 1000000;
+}
+
+/* the answer won't change if we ask again */
+static int
+retry_retryable(dpl_status_t rc)
+{
+        switch (rc) {
+        case DPL_ENOENT:
+        case DPL_EINVAL:
+        case DPL_ENOMEM:
+        case DPL_ENAMETOOLONG:
+        case DPL_ENOTDIR:
+        case DPL_ENOTEMPTY:
+        case DPL_EISDIR:
+        case DPL_EEXIST:
+                return 0;
+        default:
+                return 1;
+        }
+}
+
+/* the application gave up on the request this thread is serving; only
+ * the FUSE threads have a request to look at */
+int
+dfs_interrupted(void)
+{
+        struct fuse_context *fc = NULL;
+
+        if (retry_shutdown)
+                return 1;
+
+        fc = fuse_get_context();
+        if (! fc || ! fc->fuse)
+                return 0;
+
+        return fuse_interrupted();
+}
+
+/* sleep `delay' ms, by slices, return -1 if the wait was interrupted */
+static int
+retry_wait(int delay)
+{
+        struct timespec slice;
+        int left;
+
+        for (left = delay; left > 0; left -= RETRY_SLICE) {
+                if (dfs_interrupted())
+                        return -1;
+
+                slice.tv_sec = 0;
+                slice.tv_nsec = (left < RETRY_SLICE ? left : RETRY_SLICE) *
+                        1000000L;
+                while (-1 == nanosleep(&slice, &slice) && EINTR == errno)
+                        ;
+        }
+
+        return dfs_interrupted() ? -1 : 0;
+}
+
+/* return 1 once we waited long enough to try `r->op' again, 0 if we
+ * should give up and return `rc' */
+static int
+retry_again(struct retry *r,
+            dpl_status_t rc)
+{
+        int delay;
+        int elapsed;
+
+        if (! retry_retryable(rc) || dfs_interrupted())
+                return 0;
+
+        /* it will not come back that soon */
+        if (breaker_open()) {
+                LOG(LOG_ERR, "%s: %s, the store is out of reach",
+                    r->op, dpl_status_str(rc));
+                return 0;
+        }
+
+        if (r->tries >= conf->max_retry) {
+                LOG(LOG_ERR, "%s: %s, giving up after %d tries",
+                    r->op, dpl_status_str(rc), r->tries + 1);
+                return 0;
+        }
+
+        /* another endpoint may not have the problem, no need to wait */
+        if (! r->failed_over && endpoint_failover()) {
+                LOG(LOG_NOTICE, "%s: %s, retry %d on another endpoint",
+                    r->op, dpl_status_str(rc), r->tries + 1);
+                r->failed_over = 1;
+                r->tries++;
+                return 1;
+        }
+
+        delay = g_random_int_range(RETRY_BASE, r->delay * 3 + 1);
+        if (delay > RETRY_CAP)
+                delay = RETRY_CAP;
+
+        elapsed = retry_elapsed(r);
+        if (r->deadline && elapsed + delay > r->deadline) {
+                LOG(LOG_ERR, "%s: %s, no time left (%dms spent)",
+                    r->op, dpl_status_str(rc), elapsed);
+                return 0;
+        }
+
+        LOG(LOG_ERR, "%s: %s, retry %d in %dms",
+            r->op, dpl_status_str(rc), r->tries + 1, delay);
+
+        if (-1 == retry_wait(delay)) {
+                LOG(LOG_NOTICE, "%s: interrupted", r->op);
+                return 0;
+        }
+
+        r->tries++;
+        r->delay = delay;
+
+        return 1;
+}
 
 static dpl_status_t
 dfs_getattr_gen_timeout(dpl_ctx_t *ctx,
@@ -16,22 +198,19 @@ dfs_getattr_gen_timeout(dpl_ctx_t *ctx,
                         int all_headers,
                         dpl_dict_t **metadatap)
 {
-        int tries = 0;
-        int delay = 1;
+        struct retry r;
+        struct throttle t;
         dpl_status_t rc;
 
-  retry:
-        if (all_headers)
-                rc = dpl_getattr_raw(ctx, (char *)path, metadatap);
-        else
-                rc = dpl_getattr(ctx, (char *)path, metadatap);
-
-        if (DPL_SUCCESS != rc && DPL_EISDIR != rc) {
-                if (DPL_ENOENT != rc && (tries < conf->max_retry)) {
-                        ERR_TIMEOUT(dpl_getattr);
-                        goto retry;
-                }
-        }
+        rc = retry_init(&r, "dpl_getattr", conf->retry_deadline);
+        if (DPL_SUCCESS != rc)
+                return rc;
+
+        do {
+                throttle_enter(&t, 1);
+                rc = hedge_getattr(path, all_headers, metadatap);
+                throttle_leave(&t, rc);
+        } while (DPL_SUCCESS != rc && retry_again(&r, rc));
 
         return rc;
 }
@@ -57,16 +236,22 @@ dfs_setattr_timeout(dpl_ctx_t *ctx,
                     const char *path,
                     dpl_dict_t *metadata)
 {
-        int tries = 0;
-        int delay = 1;
+        struct retry r;
+        struct throttle t;
+        struct endpoint *ep = NULL;
         dpl_status_t rc;
 
-  retry:
-        rc = dpl_setattr(ctx, (char *)path, metadata);
-        if (DPL_SUCCESS != rc && DPL_EISDIR != rc && (tries < conf->max_retry)) {
-                ERR_TIMEOUT(dpl_setattr);
-                goto retry;
-        }
+        rc = retry_init(&r, "dpl_setattr", conf->retry_deadline);
+        if (DPL_SUCCESS != rc)
+                return rc;
+
+        do {
+                throttle_enter(&t, 1);
+                ep = endpoint_get();
+                rc = dpl_setattr(endpoint_ctx(ep), (char *)path, metadata);
+                endpoint_put(ep, rc, t.timed ? &t.start : NULL);
+                throttle_leave(&t, rc);
+        } while (DPL_SUCCESS != rc && retry_again(&r, rc));
 
         return rc;
 }
@@ -75,20 +260,24 @@ dpl_status_t
 dfs_mknod_timeout(dpl_ctx_t *ctx,
                   const char *path)
 {
+        struct retry r;
+        struct throttle t;
+        struct endpoint *ep = NULL;
         dpl_status_t rc;
-        int tries = 0;
-        int delay = 1;
 
         LOG(LOG_DEBUG, "%s", path);
 
- retry:
-        rc = dpl_mknod(ctx, (char *)path);
-        if (DPL_SUCCESS != rc) {
-                if (tries < conf->max_retry) {
-                        ERR_TIMEOUT(dpl_mknod);
-                        goto retry;
-                }
-        }
+        rc = retry_init(&r, "dpl_mknod", conf->retry_deadline);
+        if (DPL_SUCCESS != rc)
+                return rc;
+
+        do {
+                throttle_enter(&t, 1);
+                ep = endpoint_get();
+                rc = dpl_mknod(endpoint_ctx(ep), (char *)path);
+                endpoint_put(ep, rc, t.timed ? &t.start : NULL);
+                throttle_leave(&t, rc);
+        } while (DPL_SUCCESS != rc && retry_again(&r, rc));
 
         return rc;
 }
@@ -97,18 +286,22 @@ dpl_status_t
 dfs_mkdir_timeout(dpl_ctx_t *ctx,
                   const char *path)
 {
+        struct retry r;
+        struct throttle t;
+        struct endpoint *ep = NULL;
         dpl_status_t rc;
-        int tries = 0;
-        int delay = 1;
-
-  retry:
-        rc = dpl_mkdir(ctx, (char *)path);
-        if (DPL_SUCCESS != rc) {
-                if (DPL_ENOENT != rc && (tries < conf->max_retry)) {
-                        ERR_TIMEOUT(dpl_mkdir);
-                        goto retry;
-                }
-        }
+
+        rc = retry_init(&r, "dpl_mkdir", conf->retry_deadline);
+        if (DPL_SUCCESS != rc)
+                return rc;
+
+        do {
+                throttle_enter(&t, 1);
+                ep = endpoint_get();
+                rc = dpl_mkdir(endpoint_ctx(ep), (char *)path);
+                endpoint_put(ep, rc, t.timed ? &t.start : NULL);
+                throttle_leave(&t, rc);
+        } while (DPL_SUCCESS != rc && retry_again(&r, rc));
 
         return rc;
 }
@@ -117,18 +310,22 @@ dpl_status_t
 dfs_unlink_timeout(dpl_ctx_t *ctx,
                    const char *path)
 {
+        struct retry r;
+        struct throttle t;
+        struct endpoint *ep = NULL;
         dpl_status_t rc;
-        int tries = 0;
-        int delay = 1;
-
-  retry:
-        rc = dpl_unlink(ctx, (char *)path);
-        if (DPL_SUCCESS != rc) {
-                if (DPL_ENOENT != rc && (tries < conf->max_retry)) {
-                        ERR_TIMEOUT(dpl_unlink);
-                        goto retry;
-                }
-        }
+
+        rc = retry_init(&r, "dpl_unlink", conf->retry_deadline);
+        if (DPL_SUCCESS != rc)
+                return rc;
+
+        do {
+                throttle_enter(&t, 1);
+                ep = endpoint_get();
+                rc = dpl_unlink(endpoint_ctx(ep), (char *)path);
+                endpoint_put(ep, rc, t.timed ? &t.start : NULL);
+                throttle_leave(&t, rc);
+        } while (DPL_SUCCESS != rc && retry_again(&r, rc));
 
         return rc;
 }
@@ -137,18 +334,22 @@ dpl_status_t
 dfs_rmdir_timeout(dpl_ctx_t *ctx,
                   const char *path)
 {
+        struct retry r;
+        struct throttle t;
+        struct endpoint *ep = NULL;
         dpl_status_t rc;
-        int tries = 0;
-        int delay = 1;
-
-  retry:
-        rc = dpl_rmdir(ctx, (char *)path);
-        if (DPL_SUCCESS != rc) {
-                if (DPL_ENOENT != rc && (tries < conf->max_retry)) {
-                        ERR_TIMEOUT(dpl_rmdir);
-                        goto retry;
-                }
-        }
+
+        rc = retry_init(&r, "dpl_rmdir", conf->retry_deadline);
+        if (DPL_SUCCESS != rc)
+                return rc;
+
+        do {
+                throttle_enter(&t, 1);
+                ep = endpoint_get();
+                rc = dpl_rmdir(endpoint_ctx(ep), (char *)path);
+                endpoint_put(ep, rc, t.timed ? &t.start : NULL);
+                throttle_leave(&t, rc);
+        } while (DPL_SUCCESS != rc && retry_again(&r, rc));
 
         return rc;
 }
@@ -158,38 +359,24 @@ dfs_fcopy_timeout(dpl_ctx_t *ctx,
                   const char *oldpath,
                   const char *newpath)
 {
+        struct retry r;
+        struct throttle t;
+        struct endpoint *ep = NULL;
         dpl_status_t rc;
-        int tries = 0;
-        int delay = 1;
-
-  retry:
-        rc = dpl_fcopy(ctx, (char *)oldpath, (char *)newpath);
-        if (DPL_SUCCESS != rc) {
-                if (DPL_ENOENT != rc && (tries < conf->max_retry)) {
-                        ERR_TIMEOUT(dpl_fcopy);
-                        goto retry;
-                }
-        }
 
-        return rc;
-}
+        /* a server side copy moves the whole object */
+        rc = retry_init(&r, "dpl_fcopy", conf->retry_data_deadline);
+        if (DPL_SUCCESS != rc)
+                return rc;
 
-dpl_status_t
-dfs_chdir_timeout(dpl_ctx_t *ctx,
-                  const char *path)
-{
-        dpl_status_t rc;
-        int tries = 0;
-        int delay = 1;
-
-  retry:
-        rc = dpl_chdir(ctx, (char *)path);
-        if (DPL_SUCCESS != rc) {
-                if (DPL_EINVAL != rc && (tries < conf->max_retry)) {
-                        ERR_TIMEOUT(dpl_chdir);
-                        goto retry;
-                }
-        }
+        do {
+                throttle_enter(&t, 0);
+                ep = endpoint_get();
+                rc = dpl_fcopy(endpoint_ctx(ep), (char *)oldpath,
+                               (char *)newpath);
+                endpoint_put(ep, rc, t.timed ? &t.start : NULL);
+                throttle_leave(&t, rc);
+        } while (DPL_SUCCESS != rc && retry_again(&r, rc));
 
         return rc;
 }
@@ -199,18 +386,22 @@ dfs_opendir_timeout(dpl_ctx_t *ctx,
                     const char *path,
                     void **dir_hdl)
 {
+        struct retry r;
+        struct throttle t;
+        struct endpoint *ep = NULL;
         dpl_status_t rc;
-        int tries = 0;
-        int delay = 1;
-
-  retry:
-        rc = dpl_opendir(ctx, (char *)path, dir_hdl);
-        if (DPL_SUCCESS != rc) {
-                if (DPL_ENOENT != rc && (tries < conf->max_retry)) {
-                        ERR_TIMEOUT(dpl_opendir);
-                        goto retry;
-                }
-        }
+
+        rc = retry_init(&r, "dpl_opendir", conf->retry_deadline);
+        if (DPL_SUCCESS != rc)
+                return rc;
+
+        do {
+                throttle_enter(&t, 1);
+                ep = endpoint_get();
+                rc = dpl_opendir(endpoint_ctx(ep), (char *)path, dir_hdl);
+                endpoint_put(ep, rc, t.timed ? &t.start : NULL);
+                throttle_leave(&t, rc);
+        } while (DPL_SUCCESS != rc && retry_again(&r, rc));
 
         return rc;
 }
@@ -224,24 +415,28 @@ dfs_namei_timeout(dpl_ctx_t *ctx,
                   dpl_ino_t *obj_ino,
                   dpl_ftype_t *type)
 {
-        int tries = 0;
-        int delay = 1;
+        struct retry r;
+        struct throttle t;
+        struct endpoint *ep = NULL;
         dpl_status_t rc;
 
-  retry:
-        rc = dpl_namei(ctx, (char *)path, ctx->cur_bucket,
-                       ino, parent_ino, obj_ino, type);
+        rc = retry_init(&r, "dpl_namei", conf->retry_deadline);
+        if (DPL_SUCCESS != rc)
+                return rc;
 
-        LOG(LOG_DEBUG,
-            "path=%s, dpl_namei: %s, parent_ino=%s, obj_ino=%s",
-            path, dpl_status_str(rc), parent_ino->key, obj_ino->key);
+        do {
+                throttle_enter(&t, 1);
+                ep = endpoint_get();
+                rc = dpl_namei(endpoint_ctx(ep), (char *)path,
+                               ctx->cur_bucket, ino, parent_ino, obj_ino,
+                               type);
 
-        if (DPL_SUCCESS != rc) {
-                if (DPL_ENOENT != rc && (tries < conf->max_retry)) {
-                        ERR_TIMEOUT(dpl_namei);
-                        goto retry;
-                }
-        }
+                LOG(LOG_DEBUG,
+                    "path=%s, dpl_namei: %s, parent_ino=%s, obj_ino=%s",
+                    path, dpl_status_str(rc), parent_ino->key, obj_ino->key);
+                endpoint_put(ep, rc, t.timed ? &t.start : NULL);
+                throttle_leave(&t, rc);
+        } while (DPL_SUCCESS != rc && retry_again(&r, rc));
 
         return rc;
 }
@@ -254,23 +449,49 @@ dfs_head_all_timeout(dpl_ctx_t *ctx,
                      dpl_condition_t *condition,
                      dpl_dict_t **metadatap)
 {
-        int tries = 0;
-        int delay = 1;
+        struct retry r;
+        struct throttle t;
         dpl_status_t rc;
 
-  retry:
-        rc = dpl_head_all(ctx,
-                          bucket,
-                          resource,
-                          subresource,
-                          condition,
-                          metadatap);
-        if (DPL_SUCCESS != rc) {
-                if (DPL_ENOENT != rc && (tries < conf->max_retry)) {
-                        ERR_TIMEOUT(dpl_head_all);
-                        goto retry;
-                }
-        }
+        rc = retry_init(&r, "dpl_head_all", conf->retry_deadline);
+        if (DPL_SUCCESS != rc)
+                return rc;
+
+        do {
+                throttle_enter(&t, 1);
+                rc = hedge_head_all(bucket,
+                                    resource,
+                                    subresource,
+                                    condition,
+                                    metadatap);
+                throttle_leave(&t, rc);
+        } while (DPL_SUCCESS != rc && retry_again(&r, rc));
+
+        return rc;
+}
+
+dpl_status_t
+dfs_openread_range_timeout(dpl_ctx_t *ctx,
+                           const char *path,
+                           int start,
+                           int end,
+                           char **data_bufp,
+                           unsigned int *data_lenp)
+{
+        struct retry r;
+        struct throttle t;
+        dpl_status_t rc;
+
+        rc = retry_init(&r, "dpl_openread_range", conf->retry_data_deadline);
+        if (DPL_SUCCESS != rc)
+                return rc;
+
+        do {
+                throttle_enter(&t, 0);
+                rc = hedge_openread_range(path, start, end,
+                                          data_bufp, data_lenp);
+                throttle_leave(&t, rc);
+        } while (DPL_SUCCESS != rc && retry_again(&r, rc));
 
         return rc;
 }
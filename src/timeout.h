@@ -3,6 +3,8 @@
 
 #include <droplet.h>
 
+/* Retried and throttled requests; each attempt goes to the context of
+ * endpoint_get(), the one given only stands for the mount. */
 dpl_status_t dfs_namei_timeout(dpl_ctx_t *, const char *, char *, dpl_ino_t, dpl_ino_t *,  dpl_ino_t *, dpl_ftype_t *);
 dpl_status_t dfs_getattr_all_headers_timeout(dpl_ctx_t *, const char *, dpl_dict_t **);
 dpl_status_t dfs_getattr_timeout(dpl_ctx_t *, const char *, dpl_dict_t **);
@@ -10,10 +12,20 @@ dpl_status_t dfs_setattr_timeout(dpl_ctx_t *, const char *, dpl_dict_t *);
 dpl_status_t dfs_head_all_timeout(dpl_ctx_t *, char *, char *, char *, dpl_condition_t *, dpl_dict_t **);
 dpl_status_t dfs_mkdir_timeout(dpl_ctx_t *, const char *);
 dpl_status_t dfs_rmdir_timeout(dpl_ctx_t *, const char *);
-dpl_status_t dfs_chdir_timeout(dpl_ctx_t *, const char *);
 dpl_status_t dfs_opendir_timeout(dpl_ctx_t *, const char *, void **);
 dpl_status_t dfs_unlink_timeout(dpl_ctx_t *, const char *);
 dpl_status_t dfs_fcopy_timeout(dpl_ctx_t *, const char *, const char *);
 dpl_status_t dfs_mknod_timeout(dpl_ctx_t *, const char *);
+void dfs_retry_shutdown(void);
+
+/* the FUSE request served by the calling thread was interrupted, or the
+ * filesystem is going down: give up between two steps */
+int dfs_interrupted(void);
+/* what a request gives up with, then; neither a failure of the store nor
+ * a sign of overload, and out of the range of the libdroplet statuses so
+ * that a real DPL_ESYS stays an I/O error */
+#define DFS_EINTR ((dpl_status_t)-1000)
+
+dpl_status_t dfs_openread_range_timeout(dpl_ctx_t *, const char *, int, int, char **, unsigned int *);
 
 #endif /* TIMEOUT_H */
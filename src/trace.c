@@ -0,0 +1,298 @@
+#include <errno.h>
+#include <glib.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "trace.h"
+#include "log.h"
+#include "prefetch.h"
+#include "tmpstr.h"
+
+/* a file used a day ago is worth half of one used right now */
+#define TRACE_HALF_LIFE (24 * 60 * 60)
+
+extern struct conf *conf;
+
+struct trace_entry {
+        char *path;
+        time_t last;
+        unsigned long long bytes;
+        unsigned int hits;
+};
+
+static GHashTable *trace = NULL;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* saved next to the cache directory, which is emptied at unmount and
+ * could hold a remote file of any name */
+static char *
+trace_file(void)
+{
+        return tmpstr_printf("%s.trace", conf->cache_dir);
+}
+
+static void
+trace_entry_free(gpointer data)
+{
+        struct trace_entry *te = data;
+
+        free(te->path);
+        free(te);
+}
+
+/* called with trace_mutex held */
+static struct trace_entry *
+trace_lookup(const char *path)
+{
+        struct trace_entry *te = NULL;
+
+        if (! trace)
+                trace = g_hash_table_new_full(g_str_hash, g_str_equal,
+                                              NULL, trace_entry_free);
+
+        te = g_hash_table_lookup(trace, path);
+        if (te)
+                return te;
+
+        te = calloc(1, sizeof *te);
+        if (! te)
+                return NULL;
+
+        te->path = strdup(path);
+        if (! te->path) {
+                free(te);
+                return NULL;
+        }
+
+        g_hash_table_insert(trace, te->path, te);
+
+        return te;
+}
+
+void
+trace_record(const char *path,
+             unsigned long long bytes)
+{
+        struct trace_entry *te = NULL;
+
+        if (! conf->trace_max_files)
+                return;
+
+        /* we could not read it back */
+        if (strchr(path, '\n'))
+                return;
+
+        pthread_mutex_lock(&trace_mutex);
+
+        te = trace_lookup(path);
+        if (te) {
+                te->last = time(NULL);
+                te->bytes += bytes;
+                te->hits++;
+        }
+
+        pthread_mutex_unlock(&trace_mutex);
+}
+
+static double
+trace_score(struct trace_entry *te,
+            time_t now)
+{
+        double age = now > te->last ? now - te->last : 0;
+
+        return (double)te->hits * TRACE_HALF_LIFE / (TRACE_HALF_LIFE + age);
+}
+
+static time_t trace_now;
+
+static int
+trace_cmp(gconstpointer a,
+          gconstpointer b)
+{
+        double sa = trace_score(*(struct trace_entry **)a, trace_now);
+        double sb = trace_score(*(struct trace_entry **)b, trace_now);
+
+        if (sa > sb)
+                return -1;
+        if (sa < sb)
+                return 1;
+        return 0;
+}
+
+static void
+cb_trace_collect(gpointer key,
+                 gpointer value,
+                 gpointer user_data)
+{
+        (void)key;
+
+        g_ptr_array_add(user_data, value);
+}
+
+/* called with trace_mutex held: the entries, most valuable first */
+static GPtrArray *
+trace_sorted(void)
+{
+        GPtrArray *entries = NULL;
+
+        entries = g_ptr_array_new();
+        if (trace)
+                g_hash_table_foreach(trace, cb_trace_collect, entries);
+
+        trace_now = time(NULL);
+        g_ptr_array_sort(entries, trace_cmp);
+
+        return entries;
+}
+
+int
+trace_save(void)
+{
+        GPtrArray *entries = NULL;
+        struct trace_entry *te = NULL;
+        FILE *fp = NULL;
+        char *file = NULL;
+        char *tmp = NULL;
+        unsigned int i;
+        int ret;
+
+        if (! conf->trace_max_files)
+                return 0;
+
+        file = trace_file();
+        tmp = tmpstr_printf("%s.tmp", file);
+
+        pthread_mutex_lock(&trace_mutex);
+
+        entries = trace_sorted();
+
+        fp = fopen(tmp, "w");
+        if (! fp) {
+                LOG(LOG_ERR, "fopen(%s): %s", tmp, strerror(errno));
+                ret = -1;
+                goto err;
+        }
+
+        /* only the head of the trace is worth keeping */
+        for (i = 0; i < entries->len && i < conf->trace_max_files; i++) {
+                te = g_ptr_array_index(entries, i);
+                fprintf(fp, "%ld %llu %u %s\n",
+                        (long)te->last, te->bytes, te->hits, te->path);
+        }
+
+        if (fclose(fp)) {
+                LOG(LOG_ERR, "fclose(%s): %s", tmp, strerror(errno));
+                ret = -1;
+                goto err;
+        }
+
+        if (-1 == rename(tmp, file)) {
+                LOG(LOG_ERR, "rename(%s, %s): %s", tmp, file, strerror(errno));
+                ret = -1;
+                goto err;
+        }
+
+        LOG(LOG_DEBUG, "%u entries saved in %s", i, file);
+
+        /* and the memory it takes must stay bounded too */
+        for (; i < entries->len; i++) {
+                te = g_ptr_array_index(entries, i);
+                g_hash_table_remove(trace, te->path);
+        }
+
+        ret = 0;
+  err:
+        g_ptr_array_free(entries, TRUE);
+        pthread_mutex_unlock(&trace_mutex);
+
+        return ret;
+}
+
+int
+trace_load(void)
+{
+        struct trace_entry *te = NULL;
+        FILE *fp = NULL;
+        char *file = NULL;
+        char line[4096];
+        char *path = NULL;
+        char *nl = NULL;
+        long last;
+        unsigned long long bytes;
+        unsigned int hits;
+        int n;
+        int loaded = 0;
+
+        if (! conf->trace_max_files)
+                return 0;
+
+        file = trace_file();
+        fp = fopen(file, "r");
+        if (! fp) {
+                if (ENOENT != errno)
+                        LOG(LOG_ERR, "fopen(%s): %s", file, strerror(errno));
+                return ENOENT == errno ? 0 : -1;
+        }
+
+        pthread_mutex_lock(&trace_mutex);
+
+        while (fgets(line, sizeof line, fp)) {
+                nl = strchr(line, '\n');
+                if (! nl)
+                        continue;
+                *nl = 0;
+
+                if (3 != sscanf(line, "%ld %llu %u %n",
+                                &last, &bytes, &hits, &n))
+                        continue;
+
+                path = line + n;
+                if ('/' != *path)
+                        continue;
+
+                te = trace_lookup(path);
+                if (! te)
+                        break;
+
+                te->last = last;
+                te->bytes = bytes;
+                te->hits = hits;
+                loaded++;
+        }
+
+        pthread_mutex_unlock(&trace_mutex);
+
+        fclose(fp);
+
+        LOG(LOG_INFO, "%d entries loaded from %s", loaded, file);
+
+        return 0;
+}
+
+void
+trace_replay(void)
+{
+        GPtrArray *entries = NULL;
+        struct trace_entry *te = NULL;
+        unsigned int i;
+
+        if (! conf->trace_max_files)
+                return;
+
+        pthread_mutex_lock(&trace_mutex);
+
+        entries = trace_sorted();
+        for (i = 0; i < entries->len && i < conf->trace_max_files; i++) {
+                te = g_ptr_array_index(entries, i);
+                prefetch_push(te->path);
+        }
+
+        pthread_mutex_unlock(&trace_mutex);
+
+        LOG(LOG_INFO, "%u files queued for prefetch", i);
+
+        g_ptr_array_free(entries, TRUE);
+}
@@ -0,0 +1,16 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+/* Access trace: for each file, when it was last used, how many times and
+ * how many bytes were read from it. It is saved next to the cache
+ * directory and replayed as background prefetch at the next mount. */
+
+void trace_record(const char *, unsigned long long);
+
+int trace_load(void);
+int trace_save(void);
+
+/* queue the most valuable files of the trace for prefetch */
+void trace_replay(void);
+
+#endif /* TRACE_H */
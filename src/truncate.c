@@ -0,0 +1,45 @@
+#include <unistd.h>
+#include <errno.h>
+
+#include "truncate.h"
+#include "hash.h"
+#include "log.h"
+
+int
+dfs_ftruncate(const char *path,
+              off_t offset,
+              struct fuse_file_info *info)
+{
+        tpath_entry *pe = NULL;
+        int ret;
+
+        pe = (tpath_entry *)info->fh;
+        if (! pe) {
+                LOG(LOG_INFO, "no path entry");
+                ret = -EBADF;
+                goto end;
+        }
+
+        LOG(LOG_DEBUG, "%s, offset=%lld", pe->path, (long long)offset);
+
+        if (pe->fd < 0) {
+                LOG(LOG_ERR, "unusable file descriptor fd=%d", pe->fd);
+                ret = -EBADF;
+                goto end;
+        }
+
+        if (-1 == ftruncate(pe->fd, offset)) {
+                LOG(LOG_ERR, "ftruncate(fd=%d, %lld): %s",
+                    pe->fd, (long long)offset, strerror(errno));
+                ret = -errno;
+                goto end;
+        }
+
+        /* the cache file will be uploaded on release */
+        pe->flag = FLAG_DIRTY;
+        pe->keep_cache = 0;
+
+        ret = 0;
+  end:
+        return ret;
+}
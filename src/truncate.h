@@ -0,0 +1,8 @@
+#ifndef TRUNCATE_H
+#define TRUNCATE_H
+
+#include <fuse.h>
+
+int dfs_ftruncate(const char *, off_t, struct fuse_file_info *);
+
+#endif /* TRUNCATE_H */
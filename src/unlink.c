@@ -9,6 +9,8 @@
 #include "log.h"
 #include "tmpstr.h"
 #include "timeout.h"
+#include "local.h"
+#include "delete.h"
 
 extern GHashTable *hash;
 extern struct conf *conf;
@@ -25,14 +27,19 @@ dfs_unlink(const char *path)
 
         LOG(LOG_DEBUG, "path=%s", path);
 
-        rc = dfs_unlink_timeout(ctx, path);
-        if (DPL_SUCCESS != rc) {
-                LOG(LOG_ERR, "dpl_unlink_timeout: %s", dpl_status_str(rc));
-                ret = 1;
-                goto end;
+        /* in the background if enabled, the next rmdir above tells if it
+         * went wrong */
+        if (-1 == delete_queue(path)) {
+                rc = dfs_unlink_timeout(ctx, path);
+                if (DPL_SUCCESS != rc) {
+                        LOG(LOG_ERR, "dpl_unlink_timeout: %s",
+                            dpl_status_str(rc));
+                        ret = DPL_ENOENT == rc ? -ENOENT : -EIO;
+                        goto end;
+                }
         }
 
-        local = tmpstr_printf("%s/%s", conf->cache_dir, path);
+        local = local_path(path);
         if (-1 == unlink(local))
                 LOG(LOG_INFO, "unlink cache file (%s): %s",
                     local, strerror(errno));
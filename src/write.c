@@ -1,4 +1,5 @@
 #include <errno.h>
+#include <time.h>
 
 #include "log.h"
 #include "write.h"
@@ -16,14 +17,14 @@ dfs_write(const char *path,
         tpath_entry *pe = NULL;
         int ret = 0;
 
-        LOG(LOG_DEBUG, "path=%s, buf=%p, size=%zu, offset=%lld, info=%p",
-            path, (void *)buf, size, (long long)offset, (void *)info);
-
         pe = (tpath_entry *)info->fh;
 
+        LOG(LOG_DEBUG, "path=%s, buf=%p, size=%zu, offset=%lld, info=%p",
+            pe->path, (void *)buf, size, (long long)offset, (void *)info);
+
         if (pe->fd < 0) {
                 LOG(LOG_ERR, "unusable file descriptor fd=%d", pe->fd);
-                ret = EBADF;
+                ret = -EBADF;
                 goto err;
         }
 
@@ -34,6 +35,52 @@ dfs_write(const char *path,
                 goto err;
         }
 
+        /* the other openers must not keep their page cache */
+        pe->keep_cache = 0;
+        pe->last_access = time(NULL);
+
+  err:
+        LOG(LOG_DEBUG, "return value = %d", ret);
+        return ret;
+}
+
+/* let libfuse copy (or splice) the request data directly into the cache
+ * file */
+int
+dfs_write_buf(const char *path,
+              struct fuse_bufvec *buf,
+              off_t offset,
+              struct fuse_file_info *info)
+{
+        tpath_entry *pe = NULL;
+        struct fuse_bufvec dst = FUSE_BUFVEC_INIT(fuse_buf_size(buf));
+        int ret;
+
+        pe = (tpath_entry *)info->fh;
+
+        LOG(LOG_DEBUG, "path=%s, size=%zu, offset=%lld, info=%p",
+            pe->path, fuse_buf_size(buf), (long long)offset, (void *)info);
+
+        if (pe->fd < 0) {
+                LOG(LOG_ERR, "unusable file descriptor fd=%d", pe->fd);
+                ret = -EBADF;
+                goto err;
+        }
+
+        dst.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+        dst.buf[0].fd = pe->fd;
+        dst.buf[0].pos = offset;
+
+        ret = fuse_buf_copy(&dst, buf, FUSE_BUF_SPLICE_NONBLOCK);
+        if (ret < 0) {
+                LOG(LOG_ERR, "fuse_buf_copy: %s", strerror(-ret));
+                goto err;
+        }
+
+        /* the other openers must not keep their page cache */
+        pe->keep_cache = 0;
+        pe->last_access = time(NULL);
+
   err:
         LOG(LOG_DEBUG, "return value = %d", ret);
         return ret;
@@ -4,5 +4,6 @@
 #include <fuse.h>
 
 int dfs_write(const char *, const char *, size_t, off_t, struct fuse_file_info *);
+int dfs_write_buf(const char *, struct fuse_bufvec *, off_t, struct fuse_file_info *);
 
 #endif /* WRITE_H */
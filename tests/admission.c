@@ -0,0 +1,294 @@
+/*
+ * Replay a synthetic trace against a simulated disk cache, with and without
+ * the admission filter of lru_admit(), and print the hit ratio of each.
+ *
+ * The trace is a Zipf popularity over a set of hot files, with scans of
+ * files read once mixed in (a backup, a find | xargs grep).  The cache holds
+ * a fixed number of same-sized files and evicts the least recently used
+ * one; every cached file can be evicted, so the victim is always the tail.
+ * The sketch is src/sketch.c itself, fed as dfs_open() feeds it.
+ *
+ * usage: admission [capacity [files [zipf exponent]]]
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sketch.h"
+
+#define DEFAULT_CAPACITY 1000
+#define DEFAULT_FILES 50000
+#define DEFAULT_ZIPF 0.9
+#define ACCESSES 2000000
+/* a scan of SCAN_LEN files read once, every SCAN_EVERY accesses */
+#define SCAN_EVERY 50000
+#define SCAN_LEN 5000
+
+#define NSCANS (ACCESSES / SCAN_EVERY)
+#define NIL -1
+
+struct cache {
+        int capacity;
+        int used;
+        int head; /* most recently used */
+        int tail;
+        int *prev; /* per file id, NIL when not cached */
+        int *next;
+        char *cached;
+        unsigned long long hits;
+        unsigned long long lookups;
+};
+
+static unsigned long long rng_state = 88172645463325252ULL;
+
+/* xorshift64, the same trace for both runs and between runs */
+static double
+rng_next(void)
+{
+        rng_state ^= rng_state << 13;
+        rng_state ^= rng_state >> 7;
+        rng_state ^= rng_state << 17;
+
+        return (rng_state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static double *
+zipf_cdf(int n,
+         double s)
+{
+        double *cdf = NULL;
+        double sum = 0;
+        int i;
+
+        cdf = malloc(n * sizeof *cdf);
+        if (! cdf)
+                return NULL;
+
+        for (i = 0; i < n; i++) {
+                sum += 1.0 / pow(i + 1, s);
+                cdf[i] = sum;
+        }
+
+        for (i = 0; i < n; i++)
+                cdf[i] /= sum;
+
+        return cdf;
+}
+
+static int
+zipf_draw(double *cdf,
+          int n)
+{
+        double u = rng_next();
+        int lo = 0;
+        int hi = n - 1;
+        int mid;
+
+        while (lo < hi) {
+                mid = (lo + hi) / 2;
+                if (cdf[mid] < u)
+                        lo = mid + 1;
+                else
+                        hi = mid;
+        }
+
+        return lo;
+}
+
+/* file ids: the hot files first, then the scanned ones */
+static char *
+file_path(int id,
+          int files)
+{
+        static char path[64];
+
+        if (id < files)
+                snprintf(path, sizeof path, "/hot/%d", id);
+        else
+                snprintf(path, sizeof path, "/scan/%d", id - files);
+
+        return path;
+}
+
+static int
+cache_init(struct cache *c,
+           int capacity,
+           int ids)
+{
+        memset(c, 0, sizeof *c);
+        c->capacity = capacity;
+        c->head = c->tail = NIL;
+        c->prev = malloc(ids * sizeof *c->prev);
+        c->next = malloc(ids * sizeof *c->next);
+        c->cached = calloc(ids, 1);
+
+        return c->prev && c->next && c->cached ? 0 : -1;
+}
+
+static void
+cache_free(struct cache *c)
+{
+        free(c->prev);
+        free(c->next);
+        free(c->cached);
+}
+
+static void
+cache_unlink(struct cache *c,
+             int id)
+{
+        if (NIL != c->prev[id])
+                c->next[c->prev[id]] = c->next[id];
+        else
+                c->head = c->next[id];
+
+        if (NIL != c->next[id])
+                c->prev[c->next[id]] = c->prev[id];
+        else
+                c->tail = c->prev[id];
+}
+
+static void
+cache_push_head(struct cache *c,
+                int id)
+{
+        c->prev[id] = NIL;
+        c->next[id] = c->head;
+        if (NIL != c->head)
+                c->prev[c->head] = id;
+        c->head = id;
+        if (NIL == c->tail)
+                c->tail = id;
+}
+
+/* one open of file `id': a hit, or a download which may be kept */
+static void
+cache_access(struct cache *c,
+             int id,
+             int files,
+             int admission)
+{
+        char victim[64];
+        int tail;
+
+        c->lookups++;
+
+        if (admission)
+                sketch_increment(file_path(id, files));
+
+        if (c->cached[id]) {
+                c->hits++;
+                cache_unlink(c, id);
+                cache_push_head(c, id);
+                return;
+        }
+
+        if (c->used < c->capacity) {
+                c->cached[id] = 1;
+                c->used++;
+                cache_push_head(c, id);
+                return;
+        }
+
+        tail = c->tail;
+
+        /* lru_admit(): keep it only if it is seen more than the victim */
+        if (admission) {
+                snprintf(victim, sizeof victim, "%s", file_path(tail, files));
+                if (sketch_estimate(file_path(id, files)) <=
+                    sketch_estimate(victim))
+                        return;
+        }
+
+        cache_unlink(c, tail);
+        c->cached[tail] = 0;
+        c->cached[id] = 1;
+        cache_push_head(c, id);
+}
+
+static double
+replay(double *cdf,
+       int files,
+       int capacity,
+       int admission)
+{
+        struct cache c;
+        int next_scan = files;
+        int scan_left = 0;
+        int i;
+        int id;
+        double ratio;
+
+        if (-1 == cache_init(&c, capacity, files + NSCANS * SCAN_LEN)) {
+                fprintf(stderr, "can't allocate the cache\n");
+                exit(1);
+        }
+
+        rng_state = 88172645463325252ULL;
+
+        for (i = 0; i < ACCESSES; i++) {
+                if (0 == i % SCAN_EVERY && i)
+                        scan_left = SCAN_LEN;
+
+                if (scan_left) {
+                        id = next_scan++;
+                        scan_left--;
+                } else {
+                        id = zipf_draw(cdf, files);
+                }
+
+                cache_access(&c, id, files, admission);
+        }
+
+        ratio = (double)c.hits / c.lookups;
+        cache_free(&c);
+
+        return ratio;
+}
+
+int
+main(int argc,
+     char **argv)
+{
+        int capacity = DEFAULT_CAPACITY;
+        int files = DEFAULT_FILES;
+        double s = DEFAULT_ZIPF;
+        double *cdf = NULL;
+        double lru;
+        double tinylfu;
+
+        if (argc > 1)
+                capacity = atoi(argv[1]);
+        if (argc > 2)
+                files = atoi(argv[2]);
+        if (argc > 3)
+                s = atof(argv[3]);
+
+        if (capacity <= 0 || files <= 0 || s <= 0) {
+                fprintf(stderr, "usage: %s [capacity [files [zipf "
+                        "exponent]]]\n", argv[0]);
+                return 1;
+        }
+
+        cdf = zipf_cdf(files, s);
+        if (! cdf) {
+                fprintf(stderr, "can't allocate the distribution\n");
+                return 1;
+        }
+
+        printf("%d accesses, %d hot files (zipf %.2f), a scan of %d files "
+               "every %d accesses, %d files cached\n",
+               ACCESSES, files, s, SCAN_LEN, SCAN_EVERY, capacity);
+
+        lru = replay(cdf, files, capacity, 0);
+        printf("lru:               hit ratio %.4f\n", lru);
+
+        tinylfu = replay(cdf, files, capacity, 1);
+        printf("lru and admission: hit ratio %.4f\n", tinylfu);
+
+        free(cdf);
+
+        return 0;
+}
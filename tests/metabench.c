@@ -0,0 +1,233 @@
+/*
+ * getattr and readdir throughput of a mount point, from 1 to N threads.
+ *
+ * A directory of files is created under the given path, then each round
+ * runs its threads for a while: every thread stats random files of it, and
+ * lists it every READDIR_EVERY operations.  The operations per second of
+ * each round tell whether the daemon serves them in parallel.  Mount with
+ * attr_timeout=0 and entry_timeout=0, or the kernel answers the stats.
+ *
+ * usage: metabench <directory> [seconds per round [max threads [files]]]
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define DEFAULT_SECONDS 10
+#define DEFAULT_THREADS 16
+#define DEFAULT_FILES 256
+#define READDIR_EVERY 16
+
+struct worker {
+        pthread_t id;
+        unsigned int seed;
+        unsigned long long stats;
+        unsigned long long readdirs;
+        unsigned long long errors;
+};
+
+static char *dir = NULL;
+static int nfiles = DEFAULT_FILES;
+static volatile int stop = 0;
+
+static void *
+worker_run(void *arg)
+{
+        struct worker *w = arg;
+        char path[4096];
+        struct stat st;
+        struct dirent *de = NULL;
+        DIR *dh = NULL;
+        unsigned long long ops = 0;
+
+        while (! stop) {
+                if (0 == ++ops % READDIR_EVERY) {
+                        dh = opendir(dir);
+                        if (! dh) {
+                                w->errors++;
+                                continue;
+                        }
+                        while ((de = readdir(dh)))
+                                ;
+                        closedir(dh);
+                        w->readdirs++;
+                        continue;
+                }
+
+                snprintf(path, sizeof path, "%s/f%d",
+                         dir, rand_r(&w->seed) % nfiles);
+                if (-1 == stat(path, &st))
+                        w->errors++;
+                else
+                        w->stats++;
+        }
+
+        return NULL;
+}
+
+static double
+elapsed(struct timespec *start)
+{
+        struct timespec now;
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+
+        return (now.tv_sec - start->tv_sec) +
+                (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int
+round_run(int nthreads,
+          int seconds)
+{
+        struct worker *workers = NULL;
+        struct timespec start;
+        unsigned long long stats = 0;
+        unsigned long long readdirs = 0;
+        unsigned long long errors = 0;
+        double secs;
+        int i;
+        int ret;
+
+        workers = calloc(nthreads, sizeof *workers);
+        if (! workers) {
+                fprintf(stderr, "calloc: %s\n", strerror(errno));
+                return -1;
+        }
+
+        stop = 0;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        for (i = 0; i < nthreads; i++) {
+                workers[i].seed = i + 1;
+                ret = pthread_create(&workers[i].id, NULL, worker_run,
+                                     &workers[i]);
+                if (ret) {
+                        fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+                        stop = 1;
+                        nthreads = i;
+                        break;
+                }
+        }
+
+        sleep(seconds);
+        stop = 1;
+
+        for (i = 0; i < nthreads; i++) {
+                pthread_join(workers[i].id, NULL);
+                stats += workers[i].stats;
+                readdirs += workers[i].readdirs;
+                errors += workers[i].errors;
+        }
+
+        secs = elapsed(&start);
+
+        printf("%3d threads: %10.0f stat/s %8.0f readdir/s %10.0f ops/s "
+               "(%llu errors)\n", nthreads, stats / secs, readdirs / secs,
+               (stats + readdirs) / secs, errors);
+
+        free(workers);
+
+        return 0;
+}
+
+static int
+setup(void)
+{
+        char path[4096];
+        int fd;
+        int i;
+
+        if (-1 == mkdir(dir, 0755)) {
+                fprintf(stderr, "mkdir(%s): %s\n", dir, strerror(errno));
+                return -1;
+        }
+
+        for (i = 0; i < nfiles; i++) {
+                snprintf(path, sizeof path, "%s/f%d", dir, i);
+                fd = open(path, O_WRONLY|O_CREAT|O_TRUNC, 0644);
+                if (-1 == fd) {
+                        fprintf(stderr, "open(%s): %s\n",
+                                path, strerror(errno));
+                        return -1;
+                }
+                close(fd);
+        }
+
+        printf("%d files in %s\n", nfiles, dir);
+
+        return 0;
+}
+
+static void
+cleanup(void)
+{
+        char path[4096];
+        int i;
+
+        for (i = 0; i < nfiles; i++) {
+                snprintf(path, sizeof path, "%s/f%d", dir, i);
+                (void)unlink(path);
+        }
+
+        if (-1 == rmdir(dir))
+                fprintf(stderr, "rmdir(%s): %s\n", dir, strerror(errno));
+}
+
+int
+main(int argc,
+     char **argv)
+{
+        int seconds = DEFAULT_SECONDS;
+        int max_threads = DEFAULT_THREADS;
+        int nthreads;
+        int ret = 1;
+
+        if (argc < 2) {
+                fprintf(stderr, "usage: %s <directory> [seconds per round "
+                        "[max threads [files]]]\n", argv[0]);
+                return 1;
+        }
+
+        if (argc > 2)
+                seconds = atoi(argv[2]);
+        if (argc > 3)
+                max_threads = atoi(argv[3]);
+        if (argc > 4)
+                nfiles = atoi(argv[4]);
+
+        if (seconds <= 0 || max_threads <= 0 || nfiles <= 0) {
+                fprintf(stderr, "seconds, threads and files are positive\n");
+                return 1;
+        }
+
+        dir = malloc(strlen(argv[1]) + 32);
+        if (! dir) {
+                fprintf(stderr, "malloc: %s\n", strerror(errno));
+                return 1;
+        }
+        sprintf(dir, "%s/metabench.%d", argv[1], (int)getpid());
+
+        if (-1 == setup())
+                goto end;
+
+        for (nthreads = 1; nthreads <= max_threads; nthreads *= 2)
+                if (-1 == round_run(nthreads, seconds))
+                        goto end;
+
+        ret = 0;
+  end:
+        cleanup();
+        free(dir);
+
+        return ret;
+}